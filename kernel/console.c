@@ -109,7 +109,7 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    if(either_copyoutlocked(user_dst, dst, &cbuf, 1) == -1)
       break;
 
     dst++;
@@ -1,13 +1,16 @@
 struct buf;
 struct context;
 struct file;
+struct fpregs;
 struct inode;
 struct pipe;
 struct proc;
+struct sem_op;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timeout;
 
 // bio.c
 void binit(void);
@@ -24,6 +27,8 @@ void consputc(int);
 
 // exec.c
 int exec(char *, char **);
+int pagein(struct proc *, uint64, int);
+void prefault(struct proc *, uint64, uint64);
 
 // file.c
 struct file *filealloc(void);
@@ -40,6 +45,10 @@ int dirlink(struct inode *, char *, uint);
 struct inode *dirlookup(struct inode *, char *, uint *);
 struct inode *ialloc(uint, short);
 struct inode *idup(struct inode *);
+int igetwrite(struct inode *);
+void iputwrite(struct inode *);
+int idenywrite(struct inode *);
+void iallowwrite(struct inode *);
 void iinit();
 void ilock(struct inode *);
 void iput(struct inode *);
@@ -61,7 +70,11 @@ void ramdiskrw(struct buf *);
 
 // kalloc.c
 void *kalloc(void);
+void *kzalloc(void);
+int kzerofill(void);
 void kfree(void *);
+void kdup(void *);
+int krefs(void *);
 void kinit(void);
 
 // log.c
@@ -98,17 +111,36 @@ struct proc *myproc();
 void procinit(void);
 void scheduler(void) __attribute__((noreturn));
 void sched(void);
+void handoff(struct proc *);
+void fpflush(struct proc *);
+void fpload(struct proc *);
+int setaffinity(int);
+void timertick(void);
+uint64 sliceleft(struct proc *);
+void slicearm(struct proc *);
+int setquantum(int, uint64);
+void preemptcheck(void);
+int setrt(uint64, uint64);
+int setgang(int);
+void prioboost(void);
+void priolend(struct proc *, int, int);
+int prioreturn(int, int);
 void sleep(void *, struct spinlock *);
 void userinit(void);
 int wait(uint64);
 void wakeup(void *);
+int wakeproc(struct proc *, void *);
+int wakeprochere(struct proc *, void *);
 void yield(void);
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
+int either_copyoutlocked(int user_dst, uint64 dst, void *src, uint64 len);
 int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void procdump(void);
 
 // swtch.S
 void swtch(struct context *, struct context *);
+void fpsave(struct fpregs *);
+void fprestore(struct fpregs *);
 
 // spinlock.c
 void acquire(struct spinlock *);
@@ -147,6 +179,14 @@ void trapinit(void);
 void trapinithart(void);
 extern struct spinlock tickslock;
 void usertrapret(void);
+void timeout_add(struct timeout *);
+void timeout_del(struct timeout *);
+uint64 nextdeadline(void);
+uint curticks(void);
+uint64 readmtime(void);
+void timerarmby(uint64);
+void timerarm(uint64);
+void timerkick(int);
 
 // uart.c
 void uartinit(void);
@@ -165,13 +205,17 @@ void uvmfirst(pagetable_t, uchar *, uint);
 uint64 uvmalloc(pagetable_t, uint64, uint64, int);
 uint64 uvmdealloc(pagetable_t, uint64, uint64);
 int uvmcopy(pagetable_t, pagetable_t, uint64);
+int uvmcow(pagetable_t, uint64);
+int uvmlazy(pagetable_t, uint64, uint64);
 void uvmfree(pagetable_t, uint64);
 void uvmunmap(pagetable_t, uint64, uint64, int);
 void uvmclear(pagetable_t, uint64);
 pte_t *walk(pagetable_t, uint64, int);
-uint64 walkaddr(pagetable_t, uint64);
+uint64 walkaddr(pagetable_t, uint64, int);
 int copyout(pagetable_t, uint64, char *, uint64);
+int copyoutlocked(pagetable_t, uint64, char *, uint64);
 int copyin(pagetable_t, char *, uint64, uint64);
+int copyinlocked(pagetable_t, char *, uint64, uint64);
 int copyinstr(pagetable_t, char *, uint64, uint64);
 
 // plic.c
@@ -188,9 +232,26 @@ void virtio_disk_intr(void);
 // sem.c
 void init_semaphore();
 int sem_open(int id_sem, int value);
+int sem_create(int value);
 int sem_close(int id_sem);
 int sem_up(int id_sem);
 int sem_down(int id_sem);
+int sem_trydown(int id_sem);
+int sem_timeddown(int id_sem, uint deadline);
+int sem_op(struct sem_op *ops, int nops);
+int mutex_create(void);
+int mutex_lock(int id_sem);
+int mutex_unlock(int id_sem);
+void mutex_exit(void);
+
+// trace.c
+void init_trace();
+void trace_event(int, struct proc *, void *);
+
+// futex.c
+void init_futex();
+int futex_wait(uint64 uaddr, int val);
+int futex_wake(uint64 uaddr, int n);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
@@ -3,12 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -23,11 +24,12 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct segment seg[MAXSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +51,10 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where the program's segments are; pagein()
+  // reads each page from the file when it is first
+  // touched, so the file must not change until the
+  // program is done with it (see idenywrite()).
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,15 +66,26 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr + ph.memsz > TRAPFRAME)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == MAXSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep a reference to the file for pagein(), and
+  // keep the file from being written meanwhile.
+  if(idenywrite(ip) < 0)
+    goto bad;
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -119,14 +135,27 @@ exec(char *path, char **argv)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
+
+  // The new program starts with the FP unit off.
+  p->fpused = 0;
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    iallowwrite(oldexe);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +166,105 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    iallowwrite(exe);
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
+// Read page va of segment s from p's program file
+// into a new page, and map it.
+// Returns 0 on success, -1 if va is already mapped,
+// there is no memory, or the file is too short.
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+loadpage(struct proc *p, struct segment *s, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  pte_t *pte;
+  char *mem;
+  uint64 end;
+  int n;
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  if((mem = kzalloc()) == 0)
+    return -1;
+
+  // the part of the page that is in the file.
+  end = va + PGSIZE;
+  if(end > s->va + s->filesz)
+    end = s->va + s->filesz;
+  if(va < end){
+    ilock(p->exe);
+    n = readi(p->exe, 0, (uint64)mem, s->off + (va - s->va), end - va);
+    iunlock(p->exe);
+    if(n != end - va){
+      kfree(mem);
       return -1;
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|s->perm) != 0){
+    kfree(mem);
+    return -1;
   }
-  
   return 0;
 }
+
+// Map page va of p's memory, which has no mapping yet:
+// read it from the program file if it is in one of
+// the segments exec() recorded, or else zero it if
+// sbrk() reserved it (see uvmlazy()).
+// cansleep is 0 if the caller holds a spinlock, in
+// which case a page that needs the file is left alone.
+// Returns 0 on success, -1 if va is neither or the
+// page cannot be filled.
+int
+pagein(struct proc *p, uint64 va, int cansleep)
+{
+  struct segment *s;
+
+  if(va >= p->sz)
+    return -1;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz){
+      // reading the file sleeps (see prefault() for the
+      // callers that hold a spinlock), and takes the
+      // file's lock, which a read or write of p->exe
+      // itself already holds.
+      if(PGROUNDDOWN(va) < s->va + s->filesz &&
+         (!cansleep || holdingsleep(&p->exe->lock)))
+        return -1;
+      return loadpage(p, s, PGROUNDDOWN(va));
+    }
+  }
+  return uvmlazy(p->pagetable, va, p->sz);
+}
+
+// Read in the program pages in [va, va+n) that have
+// not been touched yet. For system calls that copy
+// to or from user memory while holding a spinlock
+// (pipes, the console, wait; see copyoutlocked()),
+// where pagein() cannot read the file. Bad addresses are left for the
+// copy to report.
+void
+prefault(struct proc *p, uint64 va, uint64 n)
+{
+  struct segment *s;
+  uint64 a, end;
+
+  if(va + n < va)
+    return;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    end = s->va + s->memsz;
+    if(end > va + n)
+      end = va + n;
+    if(end > p->sz)
+      end = p->sz;
+    a = va > s->va ? PGROUNDDOWN(va) : s->va;
+    for(; a < end; a += PGSIZE)
+      loadpage(p, s, a);
+  }
+}
@@ -76,6 +76,8 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable)
+      iputwrite(ff.ip);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -114,9 +116,16 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+    if(f->major < 0 || f->major >= NDEV)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    if(devsw[f->major].readat){
+      if((r = devsw[f->major].readat(1, addr, f->off, n)) > 0)
+        f->off += r;
+    } else if(devsw[f->major].read){
+      r = devsw[f->major].read(1, addr, n);
+    } else {
+      return -1;
+    }
   } else if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
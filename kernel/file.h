@@ -18,6 +18,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nwrite;         // Open files that can write it (see igetwrite())
+  int nexec;          // Processes running it (see idenywrite())
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -33,8 +35,11 @@ struct inode {
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*readat)(int, uint64, uint, int); // read at the file offset, instead of read
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define SEMSTAT 2
+#define SCHEDTRACE 3
@@ -168,6 +168,7 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
+// It also protects ip->nwrite and ip->nexec.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -287,6 +288,59 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count an open file that can write ip, unless some
+// process runs ip as its program (see idenywrite()).
+// Returns 0, or -1 if ip is busy.
+int
+igetwrite(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&itable.lock);
+  if(ip->nexec == 0){
+    ip->nwrite++;
+    r = 0;
+  }
+  release(&itable.lock);
+  return r;
+}
+
+// Undo igetwrite(ip).
+void
+iputwrite(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nwrite--;
+  release(&itable.lock);
+}
+
+// Count a process that runs ip as its program, and so
+// reads its pages on first touch (see pagein()): ip
+// cannot be written until iallowwrite(). Returns 0, or
+// -1 if ip is already open for writing.
+int
+idenywrite(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&itable.lock);
+  if(ip->nwrite == 0){
+    ip->nexec++;
+    r = 0;
+  }
+  release(&itable.lock);
+  return r;
+}
+
+// Undo idenywrite(ip).
+void
+iallowwrite(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec--;
+  release(&itable.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
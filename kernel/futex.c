@@ -0,0 +1,193 @@
+// FUTEX
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEXBUCKET 31 // Cantidad de colas de espera (primo, para repartir mejor las direcciones).
+
+// Codigos de retorno.
+#define ERROR_CODE -1
+#define SUCCESS_CODE 0
+
+/* Proceso esperando en una dirección.
+ *
+ * Igual que en los semáforos, vive en el stack de kernel del proceso dormido.
+ * La clave es la dirección FÍSICA del entero, así dos procesos que comparten
+ * una página (ver PTE_S) esperan en la misma clave aunque la vean en
+ * direcciones virtuales distintas.
+ */
+struct futex_waiter
+{
+  uint64 key;                // Dirección física del entero.
+  struct proc *proc;         // Proceso que espera.
+  struct futex_waiter *next; // Siguiente en la cola.
+  int woken;                 // `1` cuando futex_wake lo despertó.
+};
+
+struct futex_bucket
+{
+  struct spinlock lock;       // Protege la cola.
+  struct futex_waiter *head;  // Procesos esperando, en orden FIFO.
+  struct futex_waiter *tail;
+} __attribute__((aligned(CACHELINE)));
+
+struct futex_bucket futex_table[NFUTEXBUCKET];
+
+/* -------------- Funciones AUXILIARES ----------------*/
+
+/* Traduce una dirección de usuario a su clave (dirección física).
+ *
+ * RETURN:
+ *   - La dirección física del entero.
+ *   - `0` si la dirección no está alineada o no está mapeada.
+ */
+static uint64 futex_key(uint64 uaddr)
+{
+  uint64 pa;
+
+  if (uaddr % sizeof(int) != 0)
+    return 0;
+  // Una página privada que sigue compartida por COW después de un fork le daría
+  // la misma clave a padre e hijo: se separa antes.
+  uvmcow(myproc()->pagetable, PGROUNDDOWN(uaddr));
+  if ((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(uaddr), 1)) == 0)
+    return 0;
+  return pa + (uaddr - PGROUNDDOWN(uaddr));
+}
+
+static struct futex_bucket *futex_bucket(uint64 key)
+{
+  return &futex_table[(key >> 2) % NFUTEXBUCKET];
+}
+
+/* Saca un proceso de la cola, esté donde esté.
+ *
+ * PRECON:
+ *   - Se tiene el lock de la cola.
+ */
+static void futex_unlink(struct futex_bucket *b, struct futex_waiter *w, struct futex_waiter *prev)
+{
+  if (prev)
+    prev->next = w->next;
+  else
+    b->head = w->next;
+  if (b->tail == w)
+    b->tail = prev;
+}
+
+/* ------------- Funciones para el USER ---------------*/
+
+/* Duerme mientras el entero en `uaddr` valga `val`.
+ *
+ * La comparación y el dormir son atómicos respecto de futex_wake: si otro
+ * proceso cambia el valor y llama a futex_wake, no se pierde el despertar.
+ *
+ * PARAMS:
+ *   - uaddr: Dirección de usuario de un entero (alineada a 4 bytes).
+ *   - val:   Valor esperado.
+ *
+ * RETURN:
+ *   - `0` si se despertó por un futex_wake.
+ *   - `1` si el entero no valía `val` (no se durmió).
+ *   - `-1` en caso de error (dirección inválida o proceso matado).
+ */
+int futex_wait(uint64 uaddr, int val)
+{
+  struct futex_bucket *b;
+  struct futex_waiter w, *pw, *prev;
+  uint64 key;
+
+  if ((key = futex_key(uaddr)) == 0)
+    return ERROR_CODE;
+
+  b = futex_bucket(key);
+  acquire(&b->lock);
+  if (*(volatile int *)key != val)
+  {
+    release(&b->lock);
+    return 1;
+  }
+
+  w.key = key;
+  w.proc = myproc();
+  w.next = 0;
+  w.woken = 0;
+  if (b->tail)
+    b->tail->next = &w;
+  else
+    b->head = &w;
+  b->tail = &w;
+
+  while (!w.woken)
+  {
+    if (killed(w.proc)) // Si lo mataron mientras esperaba, deja la cola.
+    {
+      for (prev = 0, pw = b->head; pw != &w; prev = pw, pw = pw->next)
+        ;
+      futex_unlink(b, &w, prev);
+      release(&b->lock);
+      return ERROR_CODE;
+    }
+    sleep(&w, &b->lock);
+  }
+  release(&b->lock);
+
+  return SUCCESS_CODE;
+}
+
+/* Despierta hasta `n` procesos esperando en `uaddr`, en orden de llegada.
+ *
+ * PARAMS:
+ *   - uaddr: Dirección de usuario de un entero (alineada a 4 bytes).
+ *   - n:     Cantidad máxima de procesos a despertar.
+ *
+ * RETURN:
+ *   - La cantidad de procesos despertados.
+ *   - `-1` en caso de error (dirección inválida).
+ */
+int futex_wake(uint64 uaddr, int n)
+{
+  struct futex_bucket *b;
+  struct futex_waiter *w, *prev, *next;
+  uint64 key;
+  int woken = 0;
+
+  if ((key = futex_key(uaddr)) == 0)
+    return ERROR_CODE;
+
+  b = futex_bucket(key);
+  acquire(&b->lock);
+  for (prev = 0, w = b->head; w && woken < n; w = next)
+  {
+    next = w->next;
+    if (w->key != key)
+    {
+      prev = w;
+      continue;
+    }
+    futex_unlink(b, w, prev);
+    w->woken = 1;
+    wakeproc(w->proc, w);
+    woken++;
+  }
+  release(&b->lock);
+
+  return woken;
+}
+
+/* ------------- Funciones solo para el KERNEL ---------------*/
+
+/* Inicializa las colas de espera de los futex (KERNEL). */
+void init_futex()
+{
+  for (int i = 0; i < NFUTEXBUCKET; i++)
+  {
+    initlock(&futex_table[i].lock, "futex");
+    futex_table[i].head = 0;
+    futex_table[i].tail = 0;
+  }
+}
@@ -23,10 +23,42 @@ struct {
   struct run *freelist;
 } kmem;
 
+// Each cpu keeps a few free pages of its own, so that
+// most kalloc()s and kfree()s take only its own lock.
+// Pages move to and from kmem in batches of KBATCH;
+// a cpu whose cache and kmem are both empty steals
+// half of another cpu's cache.
+#define KBATCH 32
+#define KCACHEMAX (2*KBATCH)
+
+// Each cpu also keeps up to KZEROMAX free pages that are
+// already zeroed, for kzalloc(). Idle harts fill them (see
+// kzerofill()), so callers that need a zeroed page need
+// not memset it.
+#define KZEROMAX 16
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;                  // Pages on freelist
+  struct run *zerolist;   // Zeroed pages, for kzalloc()
+  int nzero;              // Pages on zerolist
+} __attribute__((aligned(CACHELINE)));
+
+struct kcache kcache[NCPU];
+
+// Number of page-table mappings referring to each
+// physical page. A page goes back on the free list
+// only when the last reference is dropped by kfree().
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int kref[(PHYSTOP - KERNBASE) / PGSIZE];
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,8 +67,10 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -46,20 +80,107 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *last;
+  struct kcache *kc;
+  int n, ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // below zero: freed twice, or never allocated.
+  if((ref = __sync_sub_and_fetch(&kref[PA2REF(pa)], 1)) < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->n++;
+  if(kc->n > KCACHEMAX){
+    // too many: give a batch back to kmem.
+    r = kc->freelist;
+    for(last = r, n = 1; n < KBATCH; n++)
+      last = last->next;
+    kc->freelist = last->next;
+    kc->n -= KBATCH;
+    release(&kc->lock);
+
+    acquire(&kmem.lock);
+    last->next = kmem.freelist;
+    kmem.freelist = r;
+    release(&kmem.lock);
+  } else {
+    release(&kc->lock);
+  }
+  pop_off();
+}
+
+// Take up to n pages off the front of list *l, returning
+// them as a list and their count in *got.
+static struct run*
+ktake(struct run **l, int n, int *got)
+{
+  struct run *r, *last;
+
+  r = *l;
+  if(r == 0){
+    *got = 0;
+    return 0;
+  }
+  for(last = r, *got = 1; *got < n && last->next; (*got)++)
+    last = last->next;
+  *l = last->next;
+  last->next = 0;
+  return r;
+}
+
+// Refill this cpu's empty cache: a batch from kmem or,
+// if that is empty, half of the fullest other cache.
+// Returns the pages, without holding any lock.
+static struct run*
+krefill(int id, int *got)
+{
+  struct run *r;
+  uint64 tried;
+  int i, victim, most;
+
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r = ktake(&kmem.freelist, KBATCH, got);
   release(&kmem.lock);
+  if(r)
+    return r;
+
+  // The counts are read without locks: only a hint. A
+  // victim may have emptied before we got its lock, so
+  // try the next fullest until every cache was tried.
+  for(tried = 1L << id; ; tried |= 1L << victim){
+    victim = -1;
+    most = 0;
+    for(i = 0; i < NCPU; i++){
+      if((tried & (1L << i)) == 0 && kcache[i].n > most){
+        most = kcache[i].n;
+        victim = i;
+      }
+    }
+    if(victim < 0)
+      return 0;
+    acquire(&kcache[victim].lock);
+    r = ktake(&kcache[victim].freelist, (kcache[victim].n + 1) / 2, got);
+    kcache[victim].n -= *got;
+    release(&kcache[victim].lock);
+    if(r)
+      return r;
+  }
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -68,15 +189,145 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  struct run *r, *last;
+  struct kcache *kc;
+  int id, got;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  kc = &kcache[id];
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->n--;
+  }
+  release(&kc->lock);
 
-  if(r)
+  if(r == 0 && (r = krefill(id, &got)) != 0 && r->next){
+    // keep the rest of the batch.
+    for(last = r->next; last->next; last = last->next)
+      ;
+    acquire(&kc->lock);
+    last->next = kc->freelist;
+    kc->freelist = r->next;
+    kc->n += got - 1;
+    release(&kc->lock);
+  }
+
+  // last resort: a page kept zeroed for kzalloc(),
+  // this cpu's first.
+  for(int i = 0; r == 0 && i < NCPU; i++){
+    kc = &kcache[(id + i) % NCPU];
+    if(kc->nzero == 0) // unlocked: only a hint
+      continue;
+    acquire(&kc->lock);
+    if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+    }
+    release(&kc->lock);
+  }
+  pop_off();
+
+  if(r){
+    kref[PA2REF(r)] = 1;
+#ifdef DEBUG
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
+
+// Allocate one zeroed 4096-byte page, preferably
+// from the pool idle harts have zeroed ahead.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  if((r = kc->zerolist) != 0){
+    kc->zerolist = r->next;
+    kc->nzero--;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  if(r){
+    r->next = 0; // the only word that was not zero
+    kref[PA2REF(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero one free page for this cpu's kzalloc()s, unless
+// its pool is full or there is no page to spare in its
+// cache or kmem. Never steals from other cpus, and does
+// not touch kref: the page stays free. Called by idle
+// harts. Returns 1 if it zeroed a page.
+int
+kzerofill(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  if(kc->nzero >= KZEROMAX){
+    release(&kc->lock);
+    pop_off();
+    return 0;
+  }
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->n--;
+  }
+  release(&kc->lock);
+  if(r == 0){
+    acquire(&kmem.lock);
+    if((r = kmem.freelist) != 0)
+      kmem.freelist = r->next;
+    release(&kmem.lock);
+  }
+  if(r == 0){
+    pop_off();
+    return 0;
+  }
+
+  memset((char*)r, 0, PGSIZE);
+  acquire(&kc->lock);
+  r->next = kc->zerolist;
+  kc->zerolist = r;
+  kc->nzero++;
+  release(&kc->lock);
+  pop_off();
+  return 1;
+}
+
+// Add a reference to a page returned by kalloc(),
+// for a second mapping of the same physical page.
+// Each reference is dropped by its own kfree().
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&kref[PA2REF(pa)], 1) <= 0)
+    panic("kdup: ref");
+}
+
+// Number of references to a page returned by kalloc().
+int
+krefs(void *pa)
+{
+  return __atomic_load_n(&kref[PA2REF(pa)], __ATOMIC_RELAXED);
+}
@@ -29,6 +29,8 @@ void main()
     fileinit();         // file table
     virtio_disk_init(); // emulated hard disk
     init_semaphore();   // semaphores table
+    init_futex();       // futex wait queues
+    init_trace();       // scheduler trace rings
     userinit();         // first user process
     __sync_synchronize();
     started = 1;
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
 
 struct cpu cpus[NCPU];
 
@@ -12,6 +13,24 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+uint64 quantum = TICKCYCLES; // global quantum in mtime cycles, see setquantum().
+uint boosts;                 // prioboost() calls so far, see boostcheck().
+
+// processes in sleep(), hashed by channel, so wakeup()
+// only looks at those that may be sleeping on its chan.
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} __attribute__((aligned(CACHELINE))) sleepq[NSLEEPQ];
+
+// cpu each gang (hashed) last ran on: the gang in the high 32
+// bits and the cpu in the low ones, so gangs sharing a slot are
+// told apart. Read and written without locks: only a hint.
+uint64 gangcpu[NGANGHASH];
+
+struct spinlock rtlock;      // protects rtutil.
+int rtutil;                  // utilization reserved by real-time procs, per mille of one cpu.
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
@@ -48,9 +67,15 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&rtlock, "rt");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -102,6 +127,306 @@ allocpid()
   return pid;
 }
 
+// Pick the least loaded online CPU in p's affinity mask.
+// Keeps p->cpu if no such CPU is up yet (during boot).
+static int
+pickcpu(struct proc *p)
+{
+  struct cpu *c, *best = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online && (p->affinity & (1 << (c - cpus))) &&
+       (best == 0 || c->nrunnable < best->nrunnable))
+      best = c;
+  return best ? best - cpus : p->cpu;
+}
+
+// Is p running as real-time: in the real-time class and
+// with budget left in the current period?
+static int
+isrt(struct proc *p)
+{
+  return p->rtperiod != 0 && p->rtused < p->rtbudget;
+}
+
+// Start a new period for real-time p if the current one
+// is over at mtime now.
+static void
+rtrenew(struct proc *p, uint64 now)
+{
+  if(p->rtperiod == 0 || now < p->rtdeadline)
+    return;
+  p->rtdeadline += ((now - p->rtdeadline) / p->rtperiod + 1) * p->rtperiod;
+  p->rtused = 0;
+}
+
+// Pick a CPU for real-time p: an idle one if there is
+// one, else one running a normal process with no other
+// real-time process queued, else the normal choice.
+static int
+rtpickcpu(struct proc *p)
+{
+  struct cpu *c, *best = 0;
+  struct proc *r;
+
+  // c->proc is read without locks: only a hint.
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(!c->online || (p->affinity & (1 << (c - cpus))) == 0)
+      continue;
+    if((r = c->proc) == 0)
+      return c - cpus;
+    if(best == 0 && c->rthead == 0 && r->rtperiod == 0)
+      best = c;
+  }
+  if(best)
+    return best - cpus;
+  if((p->affinity & (1 << p->cpu)) == 0)
+    return pickcpu(p);
+  return p->cpu;
+}
+
+// The online cpu a member of gang last ran on, or -1 if
+// there is none or another gang has taken its slot since.
+static int
+gangwhere(int gang)
+{
+  uint64 g = __atomic_load_n(&gangcpu[gang % NGANGHASH], __ATOMIC_RELAXED);
+  int cpu = g & 0xffffffff;
+
+  if((int)(g >> 32) != gang || !cpus[cpu].online)
+    return -1;
+  return cpu;
+}
+
+// Put p on a run queue: a real-time p with budget left
+// goes on the real-time list of a CPU from rtpickcpu(),
+// in deadline order; any other p goes at the tail of its
+// level's queue on the CPU its gang last ran on, or else
+// p->cpu, the CPU it last ran on (or was created on),
+// unless p's affinity does not allow it.
+// Caller must hold p->lock and have made p RUNNABLE.
+static void
+runqput(struct proc *p)
+{
+  struct cpu *c;
+  struct proc *q, *prev;
+  int gcpu;
+
+  rtrenew(p, readmtime());
+  p->rqrt = isrt(p);
+  if(p->rqrt)
+    p->cpu = rtpickcpu(p);
+  else if(p->gang && (gcpu = gangwhere(p->gang)) >= 0)
+    p->cpu = gcpu; // join the rest of its gang.
+  if((p->affinity & (1 << p->cpu)) == 0)
+    p->cpu = pickcpu(p);
+  c = &cpus[p->cpu];
+
+  acquire(&c->rqlock);
+  p->rq = c;
+  if(p->rqrt){
+    // FIFO among equal deadlines.
+    for(prev = 0, q = c->rthead; q && q->rtdeadline <= p->rtdeadline; prev = q, q = q->rqnext)
+      ;
+    p->rqprev = prev;
+    p->rqnext = q;
+    if(prev)
+      prev->rqnext = p;
+    else
+      c->rthead = p;
+    if(q)
+      q->rqprev = p;
+  } else {
+    p->rqnext = 0;
+    p->rqprev = c->rqtail[p->prio];
+    if(c->rqtail[p->prio])
+      c->rqtail[p->prio]->rqnext = p;
+    else
+      c->rqhead[p->prio] = p;
+    c->rqtail[p->prio] = p;
+  }
+  c->nrunnable++;
+  release(&c->rqlock);
+
+  // a real-time process preempts a normal one, or one
+  // with a later deadline, at the next trap on c.
+  if(p->rqrt && (q = c->proc) != 0 &&
+     (q->rtperiod == 0 || q->rtdeadline > p->rtdeadline)){
+    c->resched = 1;
+#ifdef TICKLESS
+    // resched first: slicearm() looks at it after arming
+    // the timer, in case that overwrote this kick.
+    __sync_synchronize();
+    timerkick(c - cpus); // make that trap come now.
+#endif
+  }
+
+#ifdef TICKLESS
+  // wake c, or else some idle hart that can steal p.
+  struct cpu *v;
+  if(c->idle){
+    timerkick(c - cpus);
+  } else {
+    for(v = cpus; v < &cpus[NCPU]; v++){
+      if(v->idle && (p->affinity & (1 << (v - cpus)))){
+        timerkick(v - cpus);
+        break;
+      }
+    }
+  }
+#endif
+}
+
+// Unlink p from c's run queue.
+// Caller must hold c->rqlock.
+static void
+runqunlink(struct cpu *c, struct proc *p)
+{
+  if(p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else if(p->rqrt)
+    c->rthead = p->rqnext;
+  else
+    c->rqhead[p->prio] = p->rqnext;
+  if(p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else if(!p->rqrt)
+    c->rqtail[p->prio] = p->rqprev;
+  p->rq = 0;
+  p->rqnext = p->rqprev = 0;
+  c->nrunnable--;
+}
+
+// Take the real-time process with the earliest deadline,
+// or else the head of c's highest non-empty level.
+// Whoever takes a process off a run queue is the one that
+// gets to run it.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p;
+
+  acquire(&c->rqlock);
+  if((p = c->rthead) != 0)
+    runqunlink(c, p);
+  for(int i = 0; i < NPRIO && p == 0; i++)
+    if((p = c->rqhead[i]) != 0)
+      runqunlink(c, p);
+  release(&c->rqlock);
+  return p;
+}
+
+// Steal a process for idle CPU c from the peer with the
+// longest run queue. Takes the earliest deadline real-time
+// process, or else from the tail of the highest level, the
+// process that would have waited longest there, skipping
+// any whose affinity excludes c. Returns 0 if there is
+// nothing to take.
+static struct proc*
+runqsteal(struct cpu *c)
+{
+  struct cpu *v, *busiest = 0;
+  struct proc *p = 0;
+  int me = c - cpus;
+
+  // nrunnable is read without the locks: only a hint.
+  for(v = cpus; v < &cpus[NCPU]; v++)
+    if(v != c && v->nrunnable > 0 &&
+       (busiest == 0 || v->nrunnable > busiest->nrunnable))
+      busiest = v;
+  if(busiest == 0)
+    return 0;
+
+  acquire(&busiest->rqlock);
+  for(p = busiest->rthead; p; p = p->rqnext){
+    if(p->affinity & (1 << me)){
+      runqunlink(busiest, p);
+      break;
+    }
+  }
+  for(int i = 0; i < NPRIO && p == 0; i++){
+    for(p = busiest->rqtail[i]; p; p = p->rqprev){
+      if(p->affinity & (1 << me)){
+        runqunlink(busiest, p);
+        break;
+      }
+    }
+  }
+  release(&busiest->rqlock);
+  return p;
+}
+
+// Take p off whatever run queue it is on, so the caller
+// can run it. Returns 0 if another CPU already took it.
+// Caller must hold p->lock.
+static int
+runqdel(struct proc *p)
+{
+  struct cpu *c;
+  int found = 0;
+
+  if((c = p->rq) == 0)
+    return 0;
+  acquire(&c->rqlock);
+  if(p->rq == c){
+    runqunlink(c, p);
+    found = 1;
+  }
+  release(&c->rqlock);
+  return found;
+}
+
+// Move p to level prio, requeueing it if it is waiting
+// in a run queue. A queued p's level is only looked at
+// once p is off the queue, since prioboost() changes it
+// with just the run queue's lock.
+// Caller must hold p->lock.
+static void
+setprio(struct proc *p, int prio)
+{
+  int queued;
+
+  queued = runqdel(p);
+  if(p->prio != prio){
+    p->prio = prio;
+    p->used = 0;
+  }
+  if(queued)
+    runqput(p);
+}
+
+// Catch p up with the prioboost()s since it was last
+// queued or run: back to the top level with a fresh
+// slice, and a level lent by priolend() is given back
+// to the top level too, not to the one p had before.
+// prioboost() only moves the queued processes; the rest
+// are caught up here.
+// Caller must hold p->lock, and p must not be queued.
+static void
+boostcheck(struct proc *p)
+{
+  uint b = __atomic_load_n(&boosts, __ATOMIC_RELAXED);
+
+  if(p->boosts == b)
+    return;
+  p->boosts = b;
+  p->prio = 0;
+  p->used = 0;
+  if(p->baseprio > 0)
+    p->baseprio = 0;
+}
+
+// Mark p RUNNABLE and queue it.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  trace_event(p->state == RUNNING ? SCHED_YIELD : SCHED_WAKEUP, p, 0);
+  p->state = RUNNABLE;
+  boostcheck(p);
+  runqput(p);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -124,6 +449,19 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
+  p->affinity = CPUMASK_ALL;
+  p->gang = 0;
+  p->fpused = 0;
+  p->fpcpu = -1;
+  p->prio = 0;
+  p->baseprio = -1;
+  p->boosts = boosts;
+  p->nmutex = 0;
+  p->used = 0;
+  p->quantum = 0;
+  p->cycles = 0;
+  p->rtperiod = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -168,6 +506,17 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  if(p->rtutil){
+    // give back its real-time reservation.
+    acquire(&rtlock);
+    rtutil -= p->rtutil;
+    release(&rtlock);
+    p->rtutil = 0;
+  }
+  p->rtperiod = 0;
+  p->fpused = 0;
+  p->fpcpu = -1;
+  p->nseg = 0;
   p->state = UNUSED;
 }
 
@@ -249,7 +598,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -264,11 +613,22 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // only reserve the address space; pages are
+    // allocated when first touched (see uvmlazy()).
+    if(sz + n > TRAPFRAME)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // program pages above the new size are gone for
+    // good: growing again must give zeroed pages.
+    for(struct segment *s = p->seg; s < &p->seg[p->nseg]; s++){
+      if(s->va + s->memsz > sz){
+        s->memsz = sz > s->va ? sz - s->va : 0;
+        if(s->filesz > s->memsz)
+          s->filesz = s->memsz;
+      }
+    }
   }
   p->sz = sz;
   return 0;
@@ -298,6 +658,11 @@ fork(void)
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
+  if(p->fpused){
+    fpflush(p);
+    np->fp = p->fp;
+    np->fpused = 1;
+  }
 
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
@@ -307,8 +672,18 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe){
+    // cannot fail: p already keeps writers out.
+    np->exe = idup(p->exe);
+    idenywrite(np->exe);
+  }
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->affinity = p->affinity;
+  np->gang = p->gang;
+  np->quantum = p->quantum;
 
   pid = np->pid;
 
@@ -319,7 +694,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +726,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Release held mutexes, so their waiters do not wait forever.
+  mutex_exit();
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +740,14 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe){
+    iallowwrite(p->exe);
+    iput(p->exe);
+  }
   end_op();
   p->cwd = 0;
+  p->exe = 0;
+  p->nseg = 0;
 
   acquire(&wait_lock);
 
@@ -377,6 +761,7 @@ exit(int status)
 
   p->xstate = status;
   p->state = ZOMBIE;
+  trace_event(SCHED_EXIT, p, 0);
 
   release(&wait_lock);
 
@@ -408,8 +793,8 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
+          if(addr != 0 && copyoutlocked(p->pagetable, addr, (char *)&pp->xstate,
+                                        sizeof(pp->xstate)) < 0) {
             release(&pp->lock);
             release(&wait_lock);
             return -1;
@@ -434,43 +819,454 @@ wait(uint64 addr)
   }
 }
 
+// Charge p for the CPU time since p->runstart.
+// Caller must hold p->lock, and p must have been running
+// on this CPU since runstart.
+static void
+charge(struct proc *p)
+{
+  uint64 now = readmtime();
+
+  p->cycles += now - p->runstart;
+  p->used += now - p->runstart;
+  p->rtused += now - p->runstart;
+  p->runstart = now;
+  rtrenew(p, now);
+}
+
+// Cycles p may run at its level before it must yield.
+static uint64
+slicelimit(struct proc *p)
+{
+  return LEVELQUANTA(p->prio) * (p->quantum ? p->quantum : quantum);
+}
+
+// Cycles left of p's current slice (at least MINQUANTUM),
+// for programming a one-shot timer.
+uint64
+sliceleft(struct proc *p)
+{
+  uint64 limit = slicelimit(p);
+
+  if(isrt(p)){
+    // a real-time process runs until its budget is spent.
+    if(p->rtused + MINQUANTUM >= p->rtbudget)
+      return MINQUANTUM;
+    return p->rtbudget - p->rtused;
+  }
+
+  if(p->used + MINQUANTUM >= limit)
+    return MINQUANTUM;
+  return limit - p->used;
+}
+
+// Program this CPU's timer for the end of p's slice. With
+// TICKLESS the timer is one-shot and nothing else would
+// fire for a timeout that expires first, so it is armed
+// for whichever comes first. Interrupts must be disabled.
+void
+slicearm(struct proc *p)
+{
+  uint64 when = p->runstart + sliceleft(p);
+#ifdef TICKLESS
+  uint64 deadline = nextdeadline();
+
+  if(deadline && deadline < when)
+    when = deadline;
+  timerarm(when);
+  // a kick from runqput() that came before this store was
+  // overwritten by it; it set resched first, so redo it.
+  __sync_synchronize();
+  if(mycpu()->resched)
+    timerkick(cpuid());
+#else
+  timerarmby(when);
+#endif
+}
+
+// Run p on this CPU until it gives the CPU back.
+// Caller must hold p->lock and have taken p off its run queue.
+static void
+runproc(struct cpu *c, struct proc *p)
+{
+  // Switch to chosen process.  It is the process's job
+  // to release its lock and then reacquire it
+  // before jumping back to us.
+  boostcheck(p);
+  p->state = RUNNING;
+  p->cpu = c - cpus;
+  if(p->gang)
+    __atomic_store_n(&gangcpu[p->gang % NGANGHASH],
+                     (uint64)p->gang << 32 | p->cpu, __ATOMIC_RELAXED);
+  c->proc = p;
+  c->resched = 0;
+  p->runstart = readmtime();
+  slicearm(p);
+  trace_event(SCHED_DISPATCH, p, 0);
+  swtch(&c->context, &p->context);
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  charge(p);
+  c->proc = 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the process at the head of this CPU's run queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
 void
 scheduler(void)
 {
-  struct proc *p;
+  struct proc *p, *q;
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  c->handoff = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    // Nothing queued here: take work from the busiest peer.
+    if((p = runqget(c)) == 0 && (p = runqsteal(c)) == 0){
+      // Nothing to run: zero a page for kzalloc() first,
+      // one per look at the queues.
+      if(kzerofill())
+        continue;
+#ifdef TICKLESS
+      // Nothing to run: wfi until the earliest timeout or
+      // until runqput() kicks this hart. The kick is a write
+      // to mtimecmp, so the timer is armed before the last
+      // look at the queues: a kick before the arm is seen
+      // by that look, and one after it stays in mtimecmp.
+      // Interrupts stay off until wfi (which still wakes
+      // for a pending interrupt).
+      intr_off();
+      c->idle = 1;
+      timerarm(nextdeadline());
+      __sync_synchronize();
+      if((p = runqget(c)) == 0 && (p = runqsteal(c)) == 0)
+        asm volatile("wfi");
+      c->idle = 0;
+      if(p == 0)
+        continue;
+#else
+      continue;
+#endif
+    }
+
+    // p may still be on its way out of another CPU
+    // (yield() queues it before swtch), so this can spin
+    // until that CPU's scheduler releases p->lock.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued proc not runnable");
+    runproc(c, p);
+    release(&p->lock);
+
+    // The process that just ran may have asked to hand
+    // the CPU to a process it woke up; run that one now
+    // rather than whatever is next in the queue.
+    while((q = c->handoff) != 0){
+      c->handoff = 0;
+      acquire(&q->lock);
+      if(q->state == RUNNABLE && (q->affinity & (1 << (c - cpus))) &&
+         runqdel(q))
+        runproc(c, q);
+      release(&q->lock);
+    }
+  }
+}
+
+// Called on every timer interrupt taken while the current
+// process is RUNNING. Gives up the CPU once the process
+// has used its quantum; with MLFQ that also moves it down
+// a level, and it yields early if a process at a higher
+// level, or a real-time process, is waiting on this CPU.
+// A real-time process has no quantum: it yields when its
+// budget runs out or an earlier deadline is waiting.
+void
+timertick(void)
+{
+  struct proc *p = myproc();
+  struct cpu *c = mycpu();
+  int preempt, wasrt;
+  uint64 limit;
+
+  acquire(&p->lock);
+  boostcheck(p);
+  wasrt = isrt(p);
+  charge(p);
+  // with a periodic timer the process may have started just
+  // after the previous interrupt, so count a slice that is
+  // nearly used up as used up rather than run a second one.
+  limit = slicelimit(p);
+  if(wasrt){
+    preempt = !isrt(p) ||
+      (c->rthead && c->rthead->rtdeadline < p->rtdeadline);
+  } else if(p->used + limit / 8 >= limit){
+    p->used = 0;
+    if(p->prio < NPRIO - 1)
+      p->prio++;
+    preempt = 1;
+  } else {
+    preempt = c->rthead != 0;
+    for(int i = 0; i < p->prio; i++)
+      if(c->rqhead[i])
+        preempt = 1;
+  }
+  // a slice that ends before the next tick (or, with
+  // TICKLESS, any slice) needs an interrupt of its own.
+  if(!preempt)
+    slicearm(p);
+  release(&p->lock);
+
+  if(preempt)
+    yield();
+}
+
+// Yield if a real-time process was queued for this CPU
+// after the current process started running (see
+// runqput()). Called on the way out of every trap.
+void
+preemptcheck(void)
+{
+  int resched;
+
+  push_off();
+  resched = mycpu()->resched;
+  pop_off();
+  if(resched)
+    yield();
+}
+
+// Make the current process a member of gang (0 to leave
+// its gang). The members of a gang, which fork() children
+// inherit, are queued on the hart where a member last
+// ran, so processes that hand work back and forth run
+// there in turn instead of waiting on separate harts.
+int
+setgang(int gang)
+{
+  struct proc *p = myproc();
+
+  if(gang < 0)
+    return -1;
+  acquire(&p->lock);
+  p->gang = gang;
+  release(&p->lock);
+  return 0;
+}
+
+// Put the current process in the real-time class: every
+// period cycles it may run for budget cycles, ahead of all
+// normal processes and earliest deadline first among
+// real-time ones. Once the budget is spent it runs as a
+// normal process until the next period. A period of 0
+// returns it to the normal class.
+// Admission control keeps the total utilization of
+// real-time processes within RTUTIL per online CPU.
+// Returns -1 if the reservation is refused.
+int
+setrt(uint64 period, uint64 budget)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int util = 0, ncpu = 0;
+
+  if(period != 0){
+    if(budget < MINQUANTUM || budget > period)
+      return -1;
+    util = budget * 1000 / period;
+    if(util > RTUTIL)
+      return -1;
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online)
+      ncpu++;
+
+  acquire(&p->lock);
+  acquire(&rtlock);
+  if(rtutil - p->rtutil + util > RTUTIL * ncpu){
+    release(&rtlock);
+    release(&p->lock);
+    return -1;
+  }
+  rtutil += util - p->rtutil;
+  release(&rtlock);
+
+  p->rtutil = util;
+  p->rtperiod = period;
+  p->rtbudget = budget;
+  p->rtused = 0;
+  p->rtdeadline = readmtime() + period;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the quantum, in mtime cycles, of process pid, or
+// the global quantum if pid is 0. A process quantum of 0
+// goes back to using the global one. The timer keeps
+// its TICKCYCLES period: timertick() charges quanta in
+// cycles and asks for an earlier interrupt if one ends
+// before the next tick.
+// Returns the previous quantum, or -1 if there is no
+// such process or cycles is out of range.
+int
+setquantum(int pid, uint64 cycles)
+{
+  struct proc *p;
+  uint64 old;
+
+  if(cycles != 0 && (cycles < MINQUANTUM || cycles > MAXQUANTUM))
+    return -1;
+  if(pid == 0){
+    if(cycles == 0)
+      return -1;
+    old = quantum;
+    quantum = cycles;
+    return old;
+  }
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->quantum;
+      p->quantum = cycles;
       release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Move every process back to the top level, so CPU-bound
+// processes demoted long ago are not starved.
+// Called from clockintr() every BOOSTTICKS, so it only
+// appends each CPU's lower levels to its top one; the
+// processes that are not queued catch up lazily (see
+// boostcheck()).
+void
+prioboost(void)
+{
+  struct cpu *c;
+  struct proc *p;
+
+  __atomic_add_fetch(&boosts, 1, __ATOMIC_RELAXED);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    acquire(&c->rqlock);
+    for(int i = 1; i < NPRIO; i++){
+      if(c->rqhead[i] == 0)
+        continue;
+      for(p = c->rqhead[i]; p; p = p->rqnext)
+        p->prio = 0;
+      c->rqhead[i]->rqprev = c->rqtail[0];
+      if(c->rqtail[0])
+        c->rqtail[0]->rqnext = c->rqhead[i];
+      else
+        c->rqhead[0] = c->rqhead[i];
+      c->rqtail[0] = c->rqtail[i];
+      c->rqhead[i] = c->rqtail[i] = 0;
     }
+    release(&c->rqlock);
   }
 }
 
+// Priority inheritance: raise p to level prio while it
+// holds a mutex a higher level process waits for.
+// pid guards against p having exited meanwhile.
+void
+priolend(struct proc *p, int pid, int prio)
+{
+  acquire(&p->lock);
+  if(p->pid == pid && p->state != UNUSED){
+    p->lends++;
+    if(p->prio > prio){
+      if(p->baseprio < 0)
+        p->baseprio = p->prio;
+      setprio(p, prio);
+    }
+  }
+  release(&p->lock);
+}
+
+// Give back the levels priolend() lent the current
+// process, now that need is the highest level lent
+// through the mutexes it still holds (NPRIO if none):
+// go back to the level it had before the first loan,
+// or to need if that is higher, unless it has since
+// dropped below that anyway.
+// lends is p->lends from before need was computed. If
+// priolend() ran since, changes nothing and returns -1,
+// so the caller can compute need again.
+int
+prioreturn(int need, int lends)
+{
+  struct proc *p = myproc();
+  int prio;
+
+  acquire(&p->lock);
+  if(p->lends != lends){
+    release(&p->lock);
+    return -1;
+  }
+  boostcheck(p); // never undo a boost.
+  if(p->baseprio >= 0){
+    prio = need < p->baseprio ? need : p->baseprio;
+    if(p->prio < prio)
+      setprio(p, prio);
+    if(need >= p->baseprio)
+      p->baseprio = -1;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Restrict the current process to the CPUs in mask
+// (bit i is cpu i). Moves it off this CPU right away
+// if this CPU is no longer allowed.
+// Returns -1 if mask allows no online CPU.
+int
+setaffinity(int mask)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int ok = 0;
+
+  mask &= CPUMASK_ALL;
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->online && (mask & (1 << (c - cpus))))
+      ok = 1;
+  if(!ok)
+    return -1;
+
+  acquire(&p->lock);
+  p->affinity = mask;
+  release(&p->lock);
+
+  push_off();
+  int here = mask & (1 << cpuid());
+  pop_off();
+  if(!here)
+    yield();
+  return 0;
+}
+
+// Ask this CPU's scheduler to run p as soon as the
+// current process gives up the CPU. Only a hint:
+// p runs only if it is still RUNNABLE by then.
+// Interrupts must be disabled.
+void
+handoff(struct proc *p)
+{
+  mycpu()->handoff = p;
+}
+
 // Switch to scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
@@ -494,17 +1290,66 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  fpflush(p);
   swtch(&p->context, &mycpu()->context);
+  trace_event(SCHED_RUN, p, 0);
   mycpu()->intena = intena;
 }
 
+// Save p's FP registers in p->fp if user code has
+// written them since they were loaded, so that another
+// process may use the unit. The kernel never executes
+// FP instructions, so the registers still hold p's
+// values if this cpu is their owner. (FS alone is not
+// proof: kerneltrap() may restore a stale sstatus.)
+void
+fpflush(struct proc *p)
+{
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if((r_sstatus() & SSTATUS_FS) == SSTATUS_FS_DIRTY){
+    if(c->fpowner == p && p->fpcpu == cpuid())
+      fpsave(&p->fp);
+    w_sstatus((r_sstatus() & ~SSTATUS_FS) | SSTATUS_FS_CLEAN);
+  }
+  pop_off();
+}
+
+// Set up the FP unit for p's return to user space.
+// Processes that never used FP run with the unit off;
+// the others get their registers back only if this
+// cpu's were loaded with someone else's since.
+// Interrupts must be off.
+void
+fpload(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 x = r_sstatus() & ~SSTATUS_FS;
+
+  if(!p->fpused){
+    w_sstatus(x | SSTATUS_FS_OFF);
+    return;
+  }
+  if(c->fpowner != p || p->fpcpu != cpuid()){
+    w_sstatus(x | SSTATUS_FS_CLEAN);
+    fprestore(&p->fp);
+    w_sstatus(x | SSTATUS_FS_CLEAN);
+    c->fpowner = p;
+    p->fpcpu = cpuid();
+  } else if((r_sstatus() & SSTATUS_FS) == SSTATUS_FS_OFF){
+    w_sstatus(x | SSTATUS_FS_CLEAN);
+  }
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -517,6 +1362,7 @@ forkret(void)
   static int first = 1;
 
   // Still holding p->lock from scheduler.
+  trace_event(SCHED_RUN, myproc(), 0);
   release(&myproc()->lock);
 
   if (first) {
@@ -530,53 +1376,124 @@ forkret(void)
   usertrapret();
 }
 
+// The wait queue for chan.
+static struct sleepq*
+sleepqof(void *chan)
+{
+  return &sleepq[((uint64)chan / sizeof(void*)) % NSLEEPQ];
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = sleepqof(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // Once we hold p->lock and chan's wait
+  // queue lock, we can be guaranteed that
+  // we won't miss any wakeup (wakeup locks
+  // both), so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  trace_event(SCHED_SLEEP, p, chan);
+  p->sqprev = 0;
+  p->sqnext = q->head;
+  if(q->head)
+    q->head->sqprev = p;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // Leave the wait queue. Whatever woke us (wakeup,
+  // wakeproc, kill) left us on it; wakeup skips
+  // processes that are no longer SLEEPING meanwhile.
+  acquire(&q->lock);
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    q->head = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
 // Wake up all processes sleeping on chan.
+// Looks only at chan's wait queue, not all of proc[].
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
+  struct sleepq *q = sleepqof(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->sqnext) {
+    if(p != myproc() && p->chan == chan){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
+}
+
+// Wake up p if it is sleeping on chan.
+// Unlike wakeup(), touches only p instead of
+// scanning the whole process table.
+// Returns 1 if p was woken up.
+// Must be called without p->lock.
+int
+wakeproc(struct proc *p, void *chan)
+{
+  int woken = 0;
+
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan){
+    setrunnable(p);
+    woken = 1;
+  }
+  release(&p->lock);
+  return woken;
+}
+
+// Like wakeproc(), but queue p on this CPU rather than the
+// one it last ran on: the caller and p are coupled (they
+// hand off through a semaphore), so they do better taking
+// turns on one hart than bouncing between two. Gang and
+// affinity settings still take precedence (see runqput()).
+int
+wakeprochere(struct proc *p, void *chan)
+{
+  int woken = 0;
+
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan){
+    p->cpu = cpuid();
+    setrunnable(p);
+    woken = 1;
+  }
+  release(&p->lock);
+  return woken;
 }
 
 // Kill the process with the given pid.
@@ -593,7 +1510,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -637,6 +1554,20 @@ either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
   }
 }
 
+// Like either_copyout(), for a caller holding a
+// spinlock; see copyoutlocked().
+int
+either_copyoutlocked(int user_dst, uint64 dst, void *src, uint64 len)
+{
+  struct proc *p = myproc();
+  if(user_dst){
+    return copyoutlocked(p->pagetable, dst, src, len);
+  } else {
+    memmove((char *)dst, src, len);
+    return 0;
+  }
+}
+
 // Copy from either a user address, or kernel address,
 // depending on usr_src.
 // Returns 0 on success, -1 on error.
@@ -677,7 +1608,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s prio %d%s cpu %dk %s", p->pid, state, p->prio,
+           p->rtperiod ? " rt" : "", (int)(p->cycles / 1000), p->name);
     printf("\n");
   }
 }
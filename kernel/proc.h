@@ -18,13 +18,53 @@ struct context {
   uint64 s11;
 };
 
+// Saved floating-point registers, for processes that use them.
+struct fpregs {
+  uint64 f[32];
+  uint64 fcsr;
+};
+
+// Scheduling levels, 0 is the highest. Without MLFQ every
+// process stays at level 0 and gets a single quantum,
+// which is plain round robin.
+#ifdef MLFQ
+#define NPRIO           3            // number of levels
+#define LEVELQUANTA(prio) (1 << (prio)) // quanta a process may use at a level
+#define BOOSTTICKS      100          // move everyone back to level 0 this often
+#else
+#define NPRIO           1
+#define LEVELQUANTA(prio) 1
+#endif
+
+#define RTUTIL          900          // real-time utilization allowed per cpu, per mille
+#define NGANGHASH       16           // slots remembering where each gang last ran
+#define NSLEEPQ         61           // wait queues sleep() hashes channels into (prime)
+
+// Limits for setquantum(), in mtime cycles.
+#define MINQUANTUM      (TICKCYCLES / 100)
+#define MAXQUANTUM      (TICKCYCLES * 100)
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
-};
+  struct proc *handoff;       // Run this process next, if still RUNNABLE.
+  struct proc *fpowner;       // FP registers hold fpowner's, if its fpcpu is this cpu.
+
+  // run queue: RUNNABLE processes waiting for this cpu.
+  struct spinlock rqlock;     // Protects the run queue and p->rq* of its procs.
+  struct proc *rqhead[NPRIO]; // Next process to run, per level.
+  struct proc *rqtail[NPRIO];
+  struct proc *rthead;        // Real-time processes, earliest deadline first.
+  int nrunnable;              // Length of the run queue.
+  int online;                 // Set once this cpu is in scheduler().
+  int idle;                   // In wfi with nothing to run (TICKLESS).
+  int resched;                // A real-time process is waiting: yield at the next trap.
+} __attribute__((aligned(CACHELINE)));
+
+#define CPUMASK_ALL ((1 << NCPU) - 1) // Affinity mask allowing every cpu.
 
 extern struct cpu cpus[NCPU];
 
@@ -79,6 +119,28 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A pending timed wakeup of a sleeping process.
+// Lives on the sleeper's stack; see timeout_add() in trap.c.
+struct timeout {
+  uint deadline;               // Value of ticks at which to wake proc
+  struct proc *proc;           // Process to wake
+  void *chan;                  // Channel proc sleeps on
+
+  // tickslock must be held when using these:
+  struct timeout *next;        // Next timeout, in deadline order
+  int armed;                   // On the timeouts list?
+};
+
+// A loadable segment of a process's program file,
+// read in a page at a time on first touch (see pagein()).
+struct segment {
+  uint64 va;                   // Page-aligned start address
+  uint64 memsz;                // Size in memory
+  uint off;                    // Offset in the program file
+  uint filesz;                 // Bytes from the file; the rest is zero
+  int perm;                    // PTE_X and/or PTE_W
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,6 +153,34 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p goes back to
+  int affinity;                // Mask of CPUs p may run on
+  int gang;                    // Gang p is co-scheduled with, 0 if none
+  int prio;                    // Scheduling level (also needs rqlock if queued)
+  int baseprio;                // Level before priolend() raised it, or -1
+  uint boosts;                 // prioboost()s p has caught up with
+  int lends;                   // Calls to priolend() for p, see prioreturn()
+  uint64 used;                 // Cycles used at this level
+  uint64 quantum;              // Own quantum in cycles, 0 to use the global one
+  uint64 cycles;               // CPU time used, in mtime cycles
+  uint64 runstart;             // mtime when p was last charged for CPU time
+
+  // real-time class (see setrt()); p->lock must be held.
+  uint64 rtperiod;             // Period in cycles, 0 if p is not real-time
+  uint64 rtbudget;             // Cycles p may run each period
+  uint64 rtdeadline;           // mtime at which the current period ends
+  uint64 rtused;               // Cycles used in the current period
+  int rtutil;                  // rtbudget / rtperiod, per mille
+
+  // the wait queue's lock must be held when using these:
+  struct proc *sqnext;         // Next and previous in chan's wait queue
+  struct proc *sqprev;
+
+  // the run queue's rqlock must be held when using these:
+  struct cpu *rq;              // Run queue p is on, or null
+  struct proc *rqnext;         // Next and previous on that queue
+  struct proc *rqprev;
+  int rqrt;                    // On the cpu's real-time list, not a level queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -100,8 +190,15 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  int nmutex;                  // Mutexes held, see mutex_exit(); may count closed ones
+  int fpused;                  // Has executed FP instructions; fp is live
+  int fpcpu;                   // CPU whose FP registers hold p's, or -1
+  struct fpregs fp;            // FP registers, when not on a cpu
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file, or null
+  int nseg;                    // Segments of exe not loaded by exec
+  struct segment seg[MAXSEG];
   char name[16];               // Process name (debugging)
-};
+} __attribute__((aligned(CACHELINE))); // proc[] entries must not share lines
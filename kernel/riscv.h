@@ -42,6 +42,10 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_FS (3L << 13)       // Floating-point unit state:
+#define SSTATUS_FS_OFF (0L << 13)   //   off, FP instructions trap
+#define SSTATUS_FS_CLEAN (2L << 13) //   on, registers unchanged since loaded
+#define SSTATUS_FS_DIRTY (3L << 13) //   on, registers written since
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -343,6 +347,8 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_S (1L << 8) // software: shared with children on fork
+#define PTE_COW (1L << 9) // software: copy on write, see uvmcow()
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -5,33 +5,150 @@
 #include "sleeplock.h"
 #include "riscv.h"
 #include "memlayout.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
+#include "sem.h"
 
-#define MAX_SEMAPHORES 100 // Número máximo de semáforos, (Ej: con 100 se tienen 101 semaforos).
+/* La tabla de semáforos crece de a una página (pedida con kalloc) a medida
+ * que se necesitan ids. Los ids van de 0 a MAX_SEMAPHORES - 1.
+ */
+#define SEM_MAXPAGES 16                                           // Máxima cantidad de páginas de la tabla.
+#define SEM_PER_PAGE ((int)(PGSIZE / sizeof(struct semaphore)))  // Semáforos por página.
+#define MAX_SEMAPHORES (SEM_MAXPAGES * SEM_PER_PAGE)              // Número máximo de semáforos.
 
 // Codigos de retorno.
 #define ERROR_CODE -1
 #define SUCCESS_CODE 0
+#define TIMEOUT_CODE 1
+#define RECURSIVE_CODE 2
 
 // Valores para indicar si un semáforo está en uso.
 #define IS_OPEN 0
 #define NOT_OPEN 1
 
-struct semaphore
+/* Proceso esperando en un semáforo.
+ *
+ * Vive en el stack de kernel del proceso dormido (dentro de sem_down), por lo
+ * que la cola no necesita memoria extra. Se encola en orden FIFO.
+ */
+struct sem_waiter
 {
-  struct spinlock lock; // Lock del semaforo.
-  int value;            // Valor del semaforo (0 , 1 ,2 , ...).
-  int status;           // Valor para indicar si el semaforo está en uso (IS_OPEN o NOT_OPEN).
+  struct proc *proc;       // Proceso que espera.
+  struct sem_waiter *next; // Siguiente en la cola.
+  int granted;             // `1` si sem_up le cedió una unidad (o lo despertó), `-1` si se cerró el semáforo.
+  int retry;               // `1` si es de sem_op: se lo despierta sin cederle unidades, para que reintente.
 };
 
-struct semaphore semaphore_table[MAX_SEMAPHORES];
+/* Estado atómico del semáforo.
+ *
+ * El valor y la cantidad de procesos en espera comparten una misma palabra de
+ * 64 bits, para que el camino rápido (sin lock) pueda verificar ambos y
+ * modificar el valor con un único compare-and-swap:
+ *   - bits  0..31: valor del semáforo.
+ *   - bits 32..63: cantidad de procesos en la cola de espera.
+ *
+ * Invariante (al soltar el lock): si hay procesos esperando, el valor es 0.
+ */
+#define SEM_VALUE(s) ((int)((s) & 0xffffffffUL))
+#define SEM_WAITERS(s) ((int)((s) >> 32))
+#define SEM_WAITER (1UL << 32)
+
+struct semaphore
+{
+  struct spinlock lock;    // Lock del semaforo (solo para el camino lento y la cola).
+  uint64 state;            // Valor y cantidad de procesos esperando (ver SEM_VALUE y SEM_WAITERS).
+  int status;              // Valor para indicar si el semaforo está en uso (IS_OPEN o NOT_OPEN).
+  uint gen;                // Se incrementa al abrirlo y al cerrarlo: distingue un id reutilizado.
+  struct sem_waiter *head; // Primer proceso en espera (el próximo en despertar).
+  struct sem_waiter *tail; // Último proceso en espera.
+  int id;                  // Id del semáforo (su posición en la tabla).
+  int next_free;           // Siguiente id en la lista de libres (`-1` si es el último).
+  int on_free;             // `1` si el id está en la lista de libres.
+  int mutex;               // `1` si es un mutex (ver mutex_create).
+  struct proc *owner;      // Mutex: proceso que lo tiene tomado (`0` si está libre).
+  int ownerpid;            // Mutex: pid de `owner` (el slot de proc se reutiliza al salir).
+  int lentprio;            // Mutex: nivel más alto que le prestaron los que esperan (`NPRIO` si ninguno).
+
+  // Estadísticas (ver struct semstat). Las dos primeras se cuentan también en
+  // el camino rápido, con operaciones atómicas; el resto con el lock tomado.
+  uint ups;
+  uint downs;
+  uint blocked;
+  uint blockticks;
+  int maxwaiters;
+} __attribute__((aligned(CACHELINE))); // Cada uno en sus propias líneas de cache: dos semáforos
+                                       // vecinos usados desde harts distintos no se pisan.
+
+/* Tabla de semáforos.
+ *
+ * `pages[i]` apunta a la página con los ids i*SEM_PER_PAGE ... (i+1)*SEM_PER_PAGE - 1.
+ * Las páginas nunca se liberan, así que un `struct semaphore *` es válido para siempre
+ * y se puede buscar un id sin tomar `lock`.
+ *
+ * La lista de libres puede contener ids que luego se abrieron con sem_open; sem_create
+ * simplemente los descarta al sacarlos.
+ */
+struct
+{
+  struct spinlock lock;                   // Protege npages, free y los campos on_free/next_free.
+  struct semaphore *pages[SEM_MAXPAGES];  // Páginas de la tabla.
+  int npages;                             // Cantidad de páginas en uso.
+  int free;                               // Primer id de la lista de libres (`-1` si está vacía).
+} semaphore_table;
 
 /* -------------- Funciones AUXILIARES ----------------*/
 
-/* Obtiene el estado de uso de un semáforo.
+/* Obtiene el semáforo con un id.
+ *
+ * RETURN:
+ *   - El semáforo.
+ *   - `0` si el id está fuera de rango o su página todavía no existe.
+ */
+static struct semaphore *getsem(int id_sem)
+{
+  if (id_sem < 0 || id_sem >= semaphore_table.npages * SEM_PER_PAGE)
+    return 0;
+  __sync_synchronize(); // Lee la página después de npages (ver sem_grow).
+  return &semaphore_table.pages[id_sem / SEM_PER_PAGE][id_sem % SEM_PER_PAGE];
+}
+
+/* Agrega una página a la tabla y pone sus ids en la lista de libres.
  *
  * PRECON:
- *   - 0 <= id_sem <= MAX_SEMAPHORES.
+ *   - Se tiene semaphore_table.lock.
+ *
+ * RETURN:
+ *   - `0` en caso de éxito.
+ *   - `-1` si la tabla está llena o no hay memoria.
+ */
+static int sem_grow(void)
+{
+  struct semaphore *page;
+  int first;
+
+  if (semaphore_table.npages == SEM_MAXPAGES || (page = kzalloc()) == 0)
+    return ERROR_CODE;
+
+  first = semaphore_table.npages * SEM_PER_PAGE;
+  for (int i = SEM_PER_PAGE - 1; i >= 0; i--) // Al revés, para que la lista quede ordenada.
+  {
+    initlock(&page[i].lock, "semaphore");
+    page[i].status = NOT_OPEN;
+    page[i].id = first + i;
+    page[i].next_free = semaphore_table.free;
+    page[i].on_free = 1;
+    semaphore_table.free = first + i;
+  }
+
+  semaphore_table.pages[semaphore_table.npages] = page;
+  __sync_synchronize(); // La página queda visible antes que el nuevo npages (ver getsem).
+  semaphore_table.npages++;
+  return SUCCESS_CODE;
+}
+
+/* Obtiene el estado de uso de un semáforo.
  *
  * RETURN:
  *   - `1` si el semáforo está en uso.
@@ -40,19 +157,237 @@ struct semaphore semaphore_table[MAX_SEMAPHORES];
  */
 int is_sem_open(int id_sem)
 {
+  struct semaphore *sem;
+
   /* Manejo de errores */
-  if (id_sem < 0 || id_sem >= MAX_SEMAPHORES)
+  if ((sem = getsem(id_sem)) == 0)
     return ERROR_CODE; // Id fuera de rango.
 
-  return semaphore_table[id_sem].status == IS_OPEN;
+  return sem->status == IS_OPEN;
+}
+
+/* Agrega un proceso al final de la cola de espera.
+ *
+ * PRECON:
+ *   - Se tiene el lock del semáforo.
+ */
+static void sem_enqueue(struct semaphore *sem, struct sem_waiter *w)
+{
+  w->next = 0;
+  if (sem->tail)
+    sem->tail->next = w;
+  else
+    sem->head = w;
+  sem->tail = w;
+}
+
+/* Saca un proceso de la cola de espera, esté donde esté.
+ * Solo se usa cuando un proceso abandona la espera (ej: fue matado).
+ *
+ * PRECON:
+ *   - Se tiene el lock del semáforo.
+ */
+static void sem_unlink(struct semaphore *sem, struct sem_waiter *w)
+{
+  struct sem_waiter **pp;
+  struct sem_waiter *prev = 0;
+
+  for (pp = &sem->head; *pp; prev = *pp, pp = &(*pp)->next)
+  {
+    if (*pp == w)
+    {
+      *pp = w->next;
+      if (sem->tail == w)
+        sem->tail = prev;
+      return;
+    }
+  }
+}
+
+/* Pone en cero las estadísticas de un semáforo que se abre.
+ *
+ * PRECON:
+ *   - Se tiene el lock del semáforo.
+ */
+static void sem_resetstats(struct semaphore *sem)
+{
+  sem->ups = 0;
+  sem->downs = 0;
+  sem->blocked = 0;
+  sem->blockticks = 0;
+  sem->maxwaiters = 0;
+}
+
+/* Despierta a los procesos en espera mientras el semáforo tenga unidades.
+ *
+ * A los procesos de sem_down se les cede una unidad directamente; a los de
+ * sem_op solo se los despierta (sin consumir) para que vuelvan a intentar.
+ * Al terminar, o la cola está vacía o el valor es 0.
+ *
+ * PRECON:
+ *   - Se tiene el lock del semáforo.
+ */
+static void sem_dispatch(struct semaphore *sem)
+{
+  struct sem_waiter *w;
+
+  while ((w = sem->head) != 0 && SEM_VALUE(sem->state) > 0)
+  {
+    sem->head = w->next;
+    if (sem->head == 0)
+      sem->tail = 0;
+    if (w->retry)
+      __sync_fetch_and_sub(&sem->state, SEM_WAITER);
+    else
+      __sync_fetch_and_sub(&sem->state, SEM_WAITER + 1);
+    w->granted = 1;
+    // Quienes se pasan unidades por un semáforo se turnan: el proceso
+    // despertado se encola en esta misma CPU (ver wakeprochere).
+#ifdef SEM_HANDOFF
+    // Si quien hizo el up se bloquea enseguida (ej: sem_op en pingpong), la
+    // CPU pasa directo al proceso despertado.
+    if (wakeprochere(w->proc, w))
+      handoff(w->proc);
+#else
+    wakeprochere(w->proc, w);
+#endif
+  }
+}
+
+/* Duerme al proceso actual al final de la cola del semáforo.
+ *
+ * PRECON:
+ *   - Se tiene el lock del semáforo.
+ *   - El proceso ya se sumó a la cantidad de procesos en espera (SEM_WAITER).
+ *
+ * PARAMS:
+ *   - retry:    `0` para esperar una unidad (sem_down), `1` para esperar a que
+ *               haya unidades sin consumirlas (sem_op).
+ *   - deadline: Valor de curticks() en el que se deja de esperar (`0` para esperar
+ *               sin límite). Lo despierta clockintr, sin que el proceso haga polling.
+ *
+ * RETURN (siempre con el lock del semáforo tomado):
+ *   - `0` al despertarse.
+ *   - `1` si se llegó a `deadline` sin que lo despierten.
+ *   - `-1` si se cerró el semáforo o mataron al proceso.
+ */
+static int sem_sleep(struct semaphore *sem, int retry, uint *deadline)
+{
+  struct sem_waiter w;
+  struct timeout t;
+  int r = SUCCESS_CODE;
+  uint ticks0 = curticks();
+
+  w.proc = myproc();
+  w.granted = 0;
+  w.retry = retry;
+  sem_enqueue(sem, &w);
+  sem->blocked++;
+  if (SEM_WAITERS(sem->state) > sem->maxwaiters)
+    sem->maxwaiters = SEM_WAITERS(sem->state);
+  if (deadline)
+  {
+    t.deadline = *deadline;
+    t.proc = w.proc;
+    t.chan = &w;
+    timeout_add(&t);
+  }
+  while (!w.granted)
+  {
+    if (killed(w.proc)) // Si lo mataron mientras esperaba, deja la cola.
+      r = ERROR_CODE;
+    else if (deadline && (int)(curticks() - *deadline) >= 0) // Se le acabó el tiempo.
+      r = TIMEOUT_CODE;
+    if (r != SUCCESS_CODE)
+    {
+      sem_unlink(sem, &w);
+      __sync_fetch_and_sub(&sem->state, SEM_WAITER);
+      break;
+    }
+    sleep(&w, &sem->lock);
+  }
+  if (deadline)
+    timeout_del(&t);
+  sem->blockticks += curticks() - ticks0;
+
+  if (w.granted < 0)
+    r = ERROR_CODE;
+  return r;
+}
+
+/* Abre un semáforo (o mutex) con un id libre de la lista de libres.
+ *
+ * RETURN:
+ *   - El id del semáforo abierto.
+ *   - `-1` si no quedan semáforos.
+ */
+static int sem_alloc(int value, int mutex)
+{
+  struct semaphore *sem;
+
+  for (;;)
+  {
+    acquire(&semaphore_table.lock);
+    if (semaphore_table.free < 0 && sem_grow() < 0)
+    {
+      release(&semaphore_table.lock);
+      return ERROR_CODE; // No quedan semáforos.
+    }
+    sem = getsem(semaphore_table.free);
+    semaphore_table.free = sem->next_free;
+    sem->on_free = 0;
+    release(&semaphore_table.lock);
+
+    acquire(&sem->lock);
+    if (sem->status == NOT_OPEN)
+    {
+      sem->status = IS_OPEN;
+      sem->gen++;
+      sem->state = value;
+      sem->mutex = mutex;
+      sem->owner = 0;
+      sem->ownerpid = 0;
+      sem->lentprio = NPRIO;
+      sem_resetstats(sem);
+      release(&sem->lock);
+      return sem->id;
+    }
+    release(&sem->lock); // Lo abrieron con sem_open mientras estaba libre: se descarta.
+  }
+}
+
+/* Incrementa un semáforo abierto, cediendo la unidad al primero de la cola si
+ * hay procesos esperando (ver sem_up y mutex_unlock).
+ */
+static void sem_release(struct semaphore *sem)
+{
+  uint64 s;
+
+  __sync_fetch_and_add(&sem->ups, 1);
+
+  // Camino rápido: si nadie espera, alcanza con incrementar el valor.
+  for (s = sem->state; SEM_WAITERS(s) == 0; s = sem->state)
+    if (__sync_bool_compare_and_swap(&sem->state, s, s + 1))
+      return;
+
+  acquire(&sem->lock); // Se "prende" el lock.
+  // --------SECCIÓN CRÍTICA --------
+  // Hay procesos esperando: la unidad pasa directamente al primero de la
+  // cola y se despierta solo a ese proceso.
+  __sync_fetch_and_add(&sem->state, 1);
+  sem_dispatch(sem);
+  // --------------------------------
+  release(&sem->lock); // Se "apaga" el lock.
 }
 
 /* ------------- Funciones para el USER ---------------*/
 
 /* Inicializar un semáforo.
+ *
+ * Si el id todavía no tiene página, la tabla crece hasta incluirlo.
  *
  * PRECON:
- *   - 0 <= id_sem <= MAX_SEMAPHORES.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
  *   - value  >= 0.
  *
  * PARAMS:
@@ -70,33 +405,72 @@ int sem_open(int id_sem, int value)
   if ((id_sem < 0 || id_sem >= MAX_SEMAPHORES) || value < 0)
     return ERROR_CODE; // Id fuera de rango -o- Valor fuera de rango
 
-  /* Se inicializa el semaforo */
-  initlock(&semaphore_table[id_sem].lock, "0" + id_sem); // Se inicializa el lock y su nombre es el id del semaforo.
+  struct semaphore *sem;
 
-  acquire(&semaphore_table[id_sem].lock); // Se abre la zona critica.
+  acquire(&semaphore_table.lock);
+  while ((sem = getsem(id_sem)) == 0) // Se agregan páginas hasta que exista el id.
+  {
+    if (sem_grow() < 0)
+    {
+      release(&semaphore_table.lock);
+      return ERROR_CODE;
+    }
+  }
+  release(&semaphore_table.lock);
+
+  acquire(&sem->lock); // Se abre la zona critica.
 
   /* Manejo de estados */
-  if (is_sem_open(id_sem)) // El caso de que el semaforo este en uso.
+  if (sem->status == IS_OPEN) // El caso de que el semaforo este en uso.
   {
-    release(&semaphore_table[id_sem].lock);
+    release(&sem->lock);
     return 1; // Codigo de error para avisar que el semaforo esta abierto.
   }
   else
   {
     // Se establecen las variables necesarias
-    semaphore_table[id_sem].status = IS_OPEN;
-    semaphore_table[id_sem].value = value;
+    sem->status = IS_OPEN;
+    sem->gen++;
+    sem->state = value; // Sin procesos esperando (la cola está vacía).
+    sem->mutex = 0;
+    sem_resetstats(sem);
 
-    release(&semaphore_table[id_sem].lock);
+    release(&sem->lock);
     return SUCCESS_CODE;
   }
 }
 
+/* Crear un semáforo con cualquier id libre.
+ *
+ * Saca un id de la lista de libres en O(1) (sin probar id por id), haciendo
+ * crecer la tabla si no quedan libres.
+ *
+ * PRECON:
+ *   - value  >= 0.
+ *
+ * PARAMS:
+ *   - value:  El valor inicial del semáforo.
+ *
+ * RETURN:
+ *   - El id del semáforo creado.
+ *   - `-1` en caso de error (valor fuera de rango o no quedan semáforos).
+ */
+int sem_create(int value)
+{
+  /* Manejo de errores */
+  if (value < 0)
+    return ERROR_CODE; // Valor fuera de rango
+
+  return sem_alloc(value, 0);
+}
+
 /* Cerrar un semáforo.
  * Libera los recursos asociados al semáforo.
  *
+ * El id vuelve a la lista de libres para que lo use sem_create.
+ *
  * PRECON:
- *   - 0 <= id_sem <= MAX_SEMAPHORES.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
  *
  * PARAMS:
  *   - id_sem: Id del semáforo a cerrar.
@@ -109,15 +483,42 @@ int sem_open(int id_sem, int value)
  */
 int sem_close(int id_sem)
 {
+  struct semaphore *sem;
+  struct sem_waiter *w;
+
   /* Manejo de errores */
-  if (id_sem < 0 || id_sem >= MAX_SEMAPHORES)
+  if ((sem = getsem(id_sem)) == 0)
     return ERROR_CODE; // Id fuera de rango.
 
-  acquire(&semaphore_table[id_sem].lock); // Se abre la zona critica.
+  acquire(&sem->lock); // Se abre la zona critica.
 
-  semaphore_table[id_sem].status = NOT_OPEN;
+  sem->status = NOT_OPEN;
+  sem->gen++;
 
-  release(&semaphore_table[id_sem].lock);
+  // Los procesos que seguían esperando se despiertan con error.
+  while ((w = sem->head) != 0)
+  {
+    sem->head = w->next;
+    w->granted = -1;
+    wakeproc(w->proc, w);
+  }
+  sem->tail = 0;
+  sem->state = 0;
+  sem->mutex = 0;
+  sem->owner = 0;
+  sem->lentprio = NPRIO;
+
+  release(&sem->lock);
+
+  // Se devuelve el id a la lista de libres (sin tener sem->lock, ver sem_create).
+  acquire(&semaphore_table.lock);
+  if (!sem->on_free)
+  {
+    sem->next_free = semaphore_table.free;
+    sem->on_free = 1;
+    semaphore_table.free = id_sem;
+  }
+  release(&semaphore_table.lock);
 
   return SUCCESS_CODE;
 }
@@ -127,7 +528,7 @@ int sem_close(int id_sem)
  *
  * PRECON:
  *   - El semáforo debe estar inicializado.
- *   - 0 <= id_sem <= MAX_SEMAPHORES.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
  *
  * PARAMS:
  *   - id_sem: Id del semáforo a incrementar.
@@ -138,58 +539,558 @@ int sem_close(int id_sem)
 int sem_up(int id_sem)
 {
   /* Manejo de errores */
-  if ((id_sem < 0 || id_sem >= MAX_SEMAPHORES) || !is_sem_open(id_sem))
-    return ERROR_CODE; // Id fuera de rango -o- El semaforo no esta inicializado
+  struct semaphore *sem;
 
-  acquire(&semaphore_table[id_sem].lock); // Se "prende" el lock.
-  // --------SECCIÓN CRÍTICA --------
-  semaphore_table[id_sem].value += 1;
-  // --------------------------------
-  wakeup(&semaphore_table[id_sem]);       // Se "despierta" el procesos que estaba durmiendo.
-  release(&semaphore_table[id_sem].lock); // Se "apaga" el lock.
+  if ((sem = getsem(id_sem)) == 0 || sem->status != IS_OPEN || sem->mutex)
+    return ERROR_CODE; // Id fuera de rango -o- El semaforo no esta inicializado -o- Es un mutex
 
+  sem_release(sem);
   return SUCCESS_CODE;
 }
 
+/* Decrementa el semáforo `sem` (ver sem_down, sem_timeddown y mutex_lock).
+ *
+ * PARAMS:
+ *   - id_sem:   Id del semáforo a decrementar.
+ *   - deadline: Valor de curticks() en el que se deja de esperar (`0` para esperar sin límite).
+ *   - mutex:    `1` si tiene que ser un mutex, `0` si tiene que ser un semáforo.
+ *
+ * RETURN:
+ *   - `0` en caso de éxito.
+ *   - `1` si se llegó a `deadline`.
+ *   - `-1` en caso de error.
+ */
+static int sem_down_until(int id_sem, uint *deadline, int mutex)
+{
+  /* Manejo de errores */
+  struct semaphore *sem;
+
+  if ((sem = getsem(id_sem)) == 0 || sem->status != IS_OPEN || sem->mutex != mutex)
+    return ERROR_CODE; // Id fuera de rango -o- El semaforo no esta inicializado -o- No es del tipo pedido
+
+  uint64 s;
+  int r;
+
+  __sync_fetch_and_add(&sem->downs, 1);
+
+  // Camino rápido: si hay unidades y nadie espera, se decrementa sin lock.
+  for (s = sem->state; SEM_VALUE(s) > 0 && SEM_WAITERS(s) == 0; s = sem->state)
+    if (__sync_bool_compare_and_swap(&sem->state, s, s - 1))
+      return SUCCESS_CODE;
+
+  acquire(&sem->lock); // Se "prende" el lock.
+  for (;;)
+  {
+    s = sem->state;
+    if (SEM_VALUE(s) > 0)
+    {
+      // --------SECCIÓN CRÍTICA --------
+      if (__sync_bool_compare_and_swap(&sem->state, s, s - 1))
+      {
+        release(&sem->lock);
+        return SUCCESS_CODE;
+      }
+      // --------------------------------
+    }
+    // Anotarse como proceso en espera hace que todo sem_up tome el camino lento.
+    else if (__sync_bool_compare_and_swap(&sem->state, s, s + SEM_WAITER))
+      break;
+  }
+
+  // Se "duerme" el proceso al final de la cola hasta que sem_up le ceda una unidad.
+  r = sem_sleep(sem, 0, deadline);
+  release(&sem->lock); // Se "apaga" el lock.
+
+  return r;
+}
+
 /* Decrementa el semáforo `sem`
  * Se utiliza para empezar a usar el semáforo. Bloqueando los procesos cuando su valor es `0`.
  *
  * PRECON:
  *   - El semáforo debe estar inicializado.
- *   - 0 <= id_sem <= MAX_SEMAPHORES.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
  *
  * PARAMS:
- *   - id_sem: Id del semáforo a cerrar.
+ *   - id_sem: Id del semáforo a decrementar.
  *
  * RETURN:
  *   - `0` en caso de éxito, otro valor en caso de error.
  */
 int sem_down(int id_sem)
+{
+  return sem_down_until(id_sem, 0, 0);
+}
+
+/* Intenta decrementar el semáforo `sem` sin bloquear.
+ *
+ * PRECON:
+ *   - El semáforo debe estar inicializado.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
+ *
+ * PARAMS:
+ *   - id_sem: Id del semáforo a decrementar.
+ *
+ * RETURN:
+ *   - `0` si se decrementó.
+ *   - `1` si el valor es `0` (o hay procesos esperando antes).
+ *   - `-1` en caso de error.
+ */
+int sem_trydown(int id_sem)
 {
   /* Manejo de errores */
-  if ((id_sem < 0 || id_sem >= MAX_SEMAPHORES) || !is_sem_open(id_sem))
-    return ERROR_CODE; // Id fuera de rango -o- El semaforo no esta inicializado
+  struct semaphore *sem;
 
-  acquire(&semaphore_table[id_sem].lock);    // Se "prende" el lock.
-  while (semaphore_table[id_sem].value == 0) // Se "dureme" el procesos simepre que el `valor` sea 0.
-    sleep(&semaphore_table[id_sem], &semaphore_table[id_sem].lock);
-  // --------SECCIÓN CRÍTICA --------
-  semaphore_table[id_sem].value -= 1;
-  // --------------------------------
-  release(&semaphore_table[id_sem].lock); // Se "apaga" el lock.
+  if ((sem = getsem(id_sem)) == 0 || sem->status != IS_OPEN || sem->mutex)
+    return ERROR_CODE; // Id fuera de rango -o- El semaforo no esta inicializado -o- Es un mutex
+
+  // Alcanza con el camino rápido: mientras hay procesos esperando el valor es 0
+  // (o las unidades ya son de ellos), así que sin él no se podría decrementar.
+  uint64 s;
+  __sync_fetch_and_add(&sem->downs, 1);
+  for (s = sem->state; SEM_VALUE(s) > 0 && SEM_WAITERS(s) == 0; s = sem->state)
+    if (__sync_bool_compare_and_swap(&sem->state, s, s - 1))
+      return SUCCESS_CODE;
+
+  return TIMEOUT_CODE;
+}
+
+/* Decrementa el semáforo `sem`, esperando como mucho hasta `deadline`.
+ *
+ * PRECON:
+ *   - El semáforo debe estar inicializado.
+ *   - 0 <= id_sem < MAX_SEMAPHORES.
+ *
+ * PARAMS:
+ *   - id_sem:   Id del semáforo a decrementar.
+ *   - deadline: Valor de curticks() (ver uptime()) en el que se deja de esperar.
+ *
+ * RETURN:
+ *   - `0` si se decrementó.
+ *   - `1` si se llegó a `deadline` sin poder decrementarlo.
+ *   - `-1` en caso de error.
+ */
+int sem_timeddown(int id_sem, uint deadline)
+{
+  if ((int)(curticks() - deadline) >= 0) // Ya venció: no se espera.
+    return sem_trydown(id_sem);
+  return sem_down_until(id_sem, &deadline, 0);
+}
+
+/* Deshace lo que se pueda de los incrementos de un sem_op que falló: a cada
+ * semáforo (si sigue siendo el mismo, de generación `gen`) le quita las
+ * unidades que le sumó y que todavía nadie tomó. No duerme.
+ *
+ * PRECON:
+ *   - No se tiene el lock de ninguno de los semáforos.
+ */
+static void sem_op_undo(struct semaphore **sems, int *delta, uint *gen, int n)
+{
+  uint64 s;
+  int take;
+
+  for (int i = 0; i < n; i++)
+  {
+    if (delta[i] <= 0)
+      continue;
+    acquire(&sems[i]->lock);
+    // Si lo cerraron (y quizás lo reabrieron para otra cosa) ya no es el mismo.
+    for (s = sems[i]->state; sems[i]->gen == gen[i]; s = sems[i]->state)
+    {
+      take = SEM_VALUE(s) < delta[i] ? SEM_VALUE(s) : delta[i];
+      if (take <= 0 || __sync_bool_compare_and_swap(&sems[i]->state, s, s - take))
+        break;
+    }
+    release(&sems[i]->lock);
+  }
+}
+
+/* Aplica varias operaciones sobre semáforos en una sola llamada.
+ *
+ * Cada operación suma `delta` al semáforo `id` (delta > 0 es un sem_up de
+ * `delta` unidades, delta < 0 un sem_down). Primero se aplican todos los
+ * incrementos y después se toman TODOS los decrementos juntos: si alguno no
+ * alcanza, no se toma ninguno y el proceso duerme hasta poder tomarlos todos.
+ * Si algún id es inválido no se aplica nada.
+ *
+ * Así, sem_op({{PONG, 1}, {PING, -1}}, 2) despierta al otro proceso y se duerme
+ * en una sola llamada al sistema.
+ *
+ * Si falla después de aplicar los incrementos (se cerró un semáforo o mataron al
+ * proceso mientras esperaba), los incrementos se deshacen en lo posible: las
+ * unidades que otro proceso ya tomó no se pueden recuperar.
+ *
+ * PRECON:
+ *   - 1 <= nops <= SEM_OPMAX.
+ *   - 0 < |delta| <= SEM_DELTAMAX en cada operación.
+ *   - Los semáforos deben estar inicializados.
+ *
+ * PARAMS:
+ *   - ops:  Operaciones a aplicar.
+ *   - nops: Cantidad de operaciones.
+ *
+ * RETURN:
+ *   - `0` en caso de éxito, otro valor en caso de error.
+ */
+int sem_op(struct sem_op *ops, int nops)
+{
+  struct semaphore *sems[SEM_OPMAX], *sem;
+  int delta[SEM_OPMAX];
+  uint gen[SEM_OPMAX];
+  int n = 0, i, j, blocked;
+  uint64 s;
+
+  /* Manejo de errores */
+  if (nops < 1 || nops > SEM_OPMAX)
+    return ERROR_CODE;
+
+  // Se ordenan por id (sumando los de igual id) para tomar los locks siempre en el mismo orden.
+  for (i = 0; i < nops; i++)
+  {
+    if (ops[i].delta == 0 || ops[i].delta > SEM_DELTAMAX || ops[i].delta < -SEM_DELTAMAX)
+      return ERROR_CODE; // Delta nulo o demasiado grande.
+    if ((sem = getsem(ops[i].id)) == 0)
+      return ERROR_CODE; // Id fuera de rango.
+    for (j = 0; j < n && sems[j]->id < sem->id; j++)
+      ;
+    if (j < n && sems[j] == sem)
+    {
+      delta[j] += ops[i].delta;
+      continue;
+    }
+    for (int k = n; k > j; k--)
+    {
+      sems[k] = sems[k - 1];
+      delta[k] = delta[k - 1];
+    }
+    sems[j] = sem;
+    delta[j] = ops[i].delta;
+    n++;
+  }
 
+  for (i = 0; i < n; i++)
+    acquire(&sems[i]->lock);
+  for (i = 0; i < n; i++)
+    if (sems[i]->status != IS_OPEN || sems[i]->mutex)
+      goto bad; // El semaforo no esta inicializado -o- Es un mutex.
+  for (i = 0; i < n; i++)
+    gen[i] = sems[i]->gen; // Para reconocerlo después de dormir.
+  for (i = 0; i < n; i++)
+    if (delta[i] > 0 && SEM_VALUE(sems[i]->state) > 0x7fffffff - delta[i])
+      goto bad; // El valor no entraría en su mitad de `state`.
+
+  // Las operaciones que se cancelan entre sí (delta 0) no cuentan.
+  for (i = 0; i < n; i++)
+    if (delta[i] != 0)
+      __sync_fetch_and_add(delta[i] > 0 ? &sems[i]->ups : &sems[i]->downs, 1);
+
+  // Incrementos.
+  for (i = 0; i < n; i++)
+  {
+    if (delta[i] > 0)
+    {
+      __sync_fetch_and_add(&sems[i]->state, delta[i]);
+      sem_dispatch(sems[i]);
+    }
+  }
+
+  // Decrementos: todos juntos o ninguno.
+  for (;;)
+  {
+    blocked = -1;
+    for (i = 0; i < n && blocked < 0; i++)
+      if (delta[i] < 0 && SEM_VALUE(sems[i]->state) < -delta[i])
+        blocked = i;
+
+    if (blocked < 0)
+    {
+      // --------SECCIÓN CRÍTICA --------
+      for (i = 0; i < n; i++)
+        if (delta[i] < 0)
+          __sync_fetch_and_sub(&sems[i]->state, -delta[i]); // Compite solo con el camino rápido de sem_up.
+      // --------------------------------
+      for (i = n - 1; i >= 0; i--)
+        release(&sems[i]->lock);
+      return SUCCESS_CODE;
+    }
+
+    // Se duerme en el semáforo que no alcanza, soltando los demás.
+    sem = sems[blocked];
+    for (i = n - 1; i >= 0; i--)
+      if (i != blocked)
+        release(&sems[i]->lock);
+    for (;;)
+    {
+      s = sem->state;
+      if (SEM_VALUE(s) >= -delta[blocked]) // Justo lo incrementaron: se reintenta.
+        break;
+      if (__sync_bool_compare_and_swap(&sem->state, s, s + SEM_WAITER))
+      {
+        if (sem_sleep(sem, 1, 0) < 0)
+        {
+          release(&sem->lock);
+          sem_op_undo(sems, delta, gen, n);
+          return ERROR_CODE; // Se cerró el semáforo o mataron al proceso.
+        }
+        break;
+      }
+    }
+    release(&sem->lock);
+
+    for (i = 0; i < n; i++)
+      acquire(&sems[i]->lock);
+    for (i = 0; i < n; i++)
+    {
+      // Lo cerraron mientras esperaba (y quizás lo reabrieron, hasta como mutex).
+      if (sems[i]->status != IS_OPEN || sems[i]->mutex || sems[i]->gen != gen[i])
+      {
+        for (i = n - 1; i >= 0; i--)
+          release(&sems[i]->lock);
+        sem_op_undo(sems, delta, gen, n);
+        return ERROR_CODE;
+      }
+    }
+  }
+
+bad:
+  for (i = n - 1; i >= 0; i--)
+    release(&sems[i]->lock);
+  return ERROR_CODE;
+}
+
+/* Crear un mutex con cualquier id libre.
+ *
+ * Un mutex es un semáforo binario que recuerda qué proceso lo tiene tomado:
+ * solo ese proceso puede soltarlo y, si lo vuelve a pedir, se le avisa en vez
+ * de bloquearlo para siempre. Comparte los ids (y la cola de espera) con los
+ * semáforos, así que se cierra con sem_close; sem_up, sem_down y sem_op no
+ * aceptan mutex.
+ *
+ * RETURN:
+ *   - El id del mutex creado.
+ *   - `-1` en caso de error (no quedan semáforos).
+ */
+int mutex_create(void)
+{
+  return sem_alloc(1, 1);
+}
+
+/* Nivel más alto que le prestaron a `p` por los mutex que tiene tomados
+ * (`NPRIO` si ninguno). Recorre toda la tabla: solo se usa si `p` heredó un
+ * nivel (ver mutex_unlock).
+ */
+static int mutex_lent(struct proc *p)
+{
+  struct semaphore *sem;
+  int need = NPRIO;
+
+  for (int id = 0; (sem = getsem(id)) != 0; id++)
+  {
+    acquire(&sem->lock);
+    if (sem->status == IS_OPEN && sem->mutex && sem->owner == p && sem->ownerpid == p->pid &&
+        sem->lentprio < need)
+      need = sem->lentprio;
+    release(&sem->lock);
+  }
+  return need;
+}
+
+/* Toma el mutex `id_sem`, esperando si otro proceso lo tiene.
+ *
+ * Mientras espera, el dueño hereda el nivel de prioridad del proceso si es
+ * más alto que el suyo (ver priolend), así termina su sección crítica sin
+ * que lo demoren procesos de prioridad intermedia. Al tomarlo, el nuevo
+ * dueño hereda el de los que siguen esperando. Cada uno lo devuelve al
+ * soltar el mutex, salvo lo que le presten por otros que todavía tiene.
+ *
+ * PRECON:
+ *   - El mutex debe estar creado (ver mutex_create).
+ *
+ * PARAMS:
+ *   - id_sem: Id del mutex a tomar.
+ *
+ * RETURN:
+ *   - `0` en caso de éxito.
+ *   - `2` si el proceso ya lo tenía tomado (no se bloquea).
+ *   - `-1` en caso de error.
+ */
+int mutex_lock(int id_sem)
+{
+  struct semaphore *sem;
+  struct proc *p = myproc();
+  int r;
+
+  /* Manejo de errores */
+  if ((sem = getsem(id_sem)) == 0)
+    return ERROR_CODE; // Id fuera de rango.
+
+  acquire(&sem->lock);
+  if (sem->status != IS_OPEN || !sem->mutex)
+  {
+    release(&sem->lock);
+    return ERROR_CODE; // El mutex no esta inicializado.
+  }
+  if (sem->owner == p && sem->ownerpid == p->pid)
+  {
+    release(&sem->lock);
+    return RECURSIVE_CODE; // Solo el dueño puede verse a sí mismo en `owner`.
+  }
+  // Herencia de prioridad (el lock del semáforo ordena a los que prestan y al dueño que devuelve).
+  if (sem->owner)
+  {
+    priolend(sem->owner, sem->ownerpid, p->prio);
+    if (p->prio < sem->lentprio)
+      sem->lentprio = p->prio;
+  }
+  release(&sem->lock);
+
+  if ((r = sem_down_until(id_sem, 0, 1)) == SUCCESS_CODE)
+  {
+    acquire(&sem->lock);
+    sem->owner = p;
+    sem->ownerpid = p->pid;
+    if (SEM_WAITERS(sem->state) == 0)
+      sem->lentprio = NPRIO;
+    else
+      priolend(p, p->pid, sem->lentprio); // Los que siguen esperando se lo prestaban al dueño anterior.
+    release(&sem->lock);
+    p->nmutex++;
+  }
+  return r;
+}
+
+/* Suelta el mutex `id_sem`, cediéndolo al primero que lo esperaba.
+ *
+ * PRECON:
+ *   - El proceso tiene tomado el mutex.
+ *
+ * PARAMS:
+ *   - id_sem: Id del mutex a soltar.
+ *
+ * RETURN:
+ *   - `0` en caso de éxito.
+ *   - `-1` en caso de error (no es un mutex o el proceso no lo tiene tomado).
+ */
+int mutex_unlock(int id_sem)
+{
+  struct semaphore *sem;
+  struct proc *p = myproc();
+
+  int lends;
+
+  /* Manejo de errores */
+  if ((sem = getsem(id_sem)) == 0)
+    return ERROR_CODE; // Id fuera de rango.
+
+  acquire(&sem->lock);
+  if (sem->status != IS_OPEN || !sem->mutex || sem->owner != p || sem->ownerpid != p->pid)
+  {
+    release(&sem->lock);
+    return ERROR_CODE; // El mutex no esta inicializado -o- No es el dueño.
+  }
+  sem->owner = 0;
+  sem->ownerpid = 0;
+  release(&sem->lock);
+  p->nmutex--;
+
+  sem_release(sem);
+
+  // Devuelve lo heredado (después de despertar al que esperaba). Un préstamo
+  // posterior a soltar `owner` es por otro mutex, así que si todavía no
+  // heredó nada no hay nada que devolver.
+  if (__atomic_load_n(&p->baseprio, __ATOMIC_RELAXED) >= 0)
+  {
+    do
+      lends = __atomic_load_n(&p->lends, __ATOMIC_RELAXED);
+    while (prioreturn(mutex_lent(p), lends) < 0);
+  }
   return SUCCESS_CODE;
 }
 
 /* ------------- Funciones solo para el KERNEL ---------------*/
 
+/* Suelta los mutex que tiene tomados el proceso actual, que está terminando
+ * (ver exit): cada uno pasa al primero que lo esperaba, en vez de quedar
+ * tomado para siempre.
+ */
+void mutex_exit(void)
+{
+  struct proc *p = myproc();
+  struct semaphore *sem;
+
+  for (int id = 0; p->nmutex > 0 && (sem = getsem(id)) != 0; id++)
+  {
+    acquire(&sem->lock);
+    if (sem->status == IS_OPEN && sem->mutex && sem->owner == p && sem->ownerpid == p->pid)
+    {
+      sem->owner = 0;
+      sem->ownerpid = 0;
+      release(&sem->lock);
+      p->nmutex--;
+      sem_release(sem);
+    }
+    else
+      release(&sem->lock);
+  }
+  p->nmutex = 0;
+}
+
+/* Lee las estadísticas de los semáforos (dispositivo SEMSTAT).
+ *
+ * El dispositivo contiene un `struct semstat` por id, en orden; `off` indica
+ * desde qué registro se lee. Solo se devuelven registros completos.
+ *
+ * PARAMS:
+ *   - user_dst: `1` si `dst` es una dirección de usuario.
+ *   - dst:      Dónde copiar los registros.
+ *   - off:      Offset (en bytes) dentro del dispositivo.
+ *   - n:        Cantidad máxima de bytes a leer.
+ *
+ * RETURN:
+ *   - La cantidad de bytes leídos (`0` al llegar al final).
+ *   - `-1` en caso de error.
+ */
+static int semstatread(int user_dst, uint64 dst, uint off, int n)
+{
+  struct semaphore *sem;
+  struct semstat st;
+  int id, r = 0;
+
+  for (id = off / sizeof(st); r + (int)sizeof(st) <= n && (sem = getsem(id)) != 0; id++)
+  {
+    acquire(&sem->lock);
+    st.id = id;
+    st.open = sem->status == IS_OPEN;
+    st.value = SEM_VALUE(sem->state);
+    st.waiters = SEM_WAITERS(sem->state);
+    st.ups = sem->ups;
+    st.downs = sem->downs;
+    st.blocked = sem->blocked;
+    st.blockticks = sem->blockticks;
+    st.maxwaiters = sem->maxwaiters;
+    release(&sem->lock);
+
+    if (either_copyout(user_dst, dst + r, &st, sizeof(st)) < 0)
+      return ERROR_CODE;
+    r += sizeof(st);
+  }
+
+  return r;
+}
+
 /* Inicializa los semáforos (KERNEL).
  *
  * ¿Como funciona ?
- * Establece todos los semaforos en `NOT_OPEN`.
+ * Crea la tabla con una sola página; el resto se pide a medida que se usa.
+ * También conecta el dispositivo SEMSTAT, como consoleinit con la consola.
  */
 void init_semaphore()
 {
-  for (int id = 0; id < MAX_SEMAPHORES; id++) // Se recorren todo los semaforos
-    semaphore_table[id].status = NOT_OPEN;    // Establece que el semáforo está en uso
+  initlock(&semaphore_table.lock, "semaphore_table");
+  semaphore_table.npages = 0;
+  semaphore_table.free = -1; // Lista de libres vacía.
+  if (sem_grow() < 0)
+    panic("init_semaphore");
+
+  devsw[SEMSTAT].readat = semstatread;
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+// Operación de sem_op(): suma `delta` al semáforo `id`.
+struct sem_op
+{
+  int id;    // Id del semáforo.
+  int delta; // Unidades a sumar (> 0, como sem_up) o a restar (< 0, como sem_down).
+};
+
+#define SEM_OPMAX 8                          // Máxima cantidad de operaciones por llamada a sem_op.
+#define SEM_DELTAMAX (0x7fffffff / SEM_OPMAX) // Máximo |delta| (así la suma de una llamada entra en un int).
+
+// Estadísticas de un semáforo, como se leen del dispositivo SEMSTAT (una por id).
+// Se cuentan desde que se abrió el semáforo.
+struct semstat
+{
+  int id;          // Id del semáforo.
+  int open;        // `1` si el semáforo está abierto.
+  int value;       // Valor actual.
+  int waiters;     // Procesos esperando ahora.
+  uint ups;        // Llamadas a sem_up (y sumas de sem_op).
+  uint downs;      // Llamadas a sem_down, sem_trydown, sem_timeddown (y restas de sem_op).
+  uint blocked;    // Veces que un proceso tuvo que dormir esperando.
+  uint blockticks; // Ticks dormidos en total.
+  int maxwaiters;  // Máxima cantidad de procesos esperando a la vez.
+};
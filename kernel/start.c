@@ -66,16 +66,22 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = TICKCYCLES;
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : desired interval (in cycles) between timer interrupts,
+  //              or 0 for one-shot: the kernel programs each
+  //              interrupt itself (see timerarm() in trap.c).
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
+#ifdef TICKLESS
+  scratch[4] = 0;
+#else
   scratch[4] = interval;
+#endif
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
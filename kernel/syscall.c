@@ -101,6 +101,20 @@ extern uint64 sys_sem_open(void);
 extern uint64 sys_sem_close(void);
 extern uint64 sys_sem_up(void);
 extern uint64 sys_sem_down(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_mapshared(void);
+extern uint64 sys_sem_create(void);
+extern uint64 sys_sem_op(void);
+extern uint64 sys_sem_trydown(void);
+extern uint64 sys_sem_timeddown(void);
+extern uint64 sys_mutex_create(void);
+extern uint64 sys_mutex_lock(void);
+extern uint64 sys_mutex_unlock(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_setquantum(void);
+extern uint64 sys_setrt(void);
+extern uint64 sys_setgang(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,6 +144,20 @@ static uint64 (*syscalls[])(void) = {
     [SYS_sem_close] sys_sem_close,
     [SYS_sem_up] sys_sem_up,
     [SYS_sem_down] sys_sem_down,
+    [SYS_futex_wait] sys_futex_wait,
+    [SYS_futex_wake] sys_futex_wake,
+    [SYS_mapshared] sys_mapshared,
+    [SYS_sem_create] sys_sem_create,
+    [SYS_sem_op] sys_sem_op,
+    [SYS_sem_trydown] sys_sem_trydown,
+    [SYS_sem_timeddown] sys_sem_timeddown,
+    [SYS_mutex_create] sys_mutex_create,
+    [SYS_mutex_lock] sys_mutex_lock,
+    [SYS_mutex_unlock] sys_mutex_unlock,
+    [SYS_setaffinity] sys_setaffinity,
+    [SYS_setquantum] sys_setquantum,
+    [SYS_setrt] sys_setrt,
+    [SYS_setgang] sys_setgang,
 };
 
 void syscall(void)
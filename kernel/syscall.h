@@ -24,3 +24,17 @@
 #define SYS_sem_close 23
 #define SYS_sem_up 24
 #define SYS_sem_down 25
+#define SYS_futex_wait 26
+#define SYS_futex_wake 27
+#define SYS_mapshared 28
+#define SYS_sem_create 29
+#define SYS_sem_op 30
+#define SYS_sem_trydown 31
+#define SYS_sem_timeddown 32
+#define SYS_mutex_create 33
+#define SYS_mutex_lock 34
+#define SYS_mutex_unlock 35
+#define SYS_setaffinity 36
+#define SYS_setquantum 37
+#define SYS_setrt 38
+#define SYS_setgang 39
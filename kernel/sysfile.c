@@ -76,6 +76,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  prefault(myproc(), p, n);
   return fileread(f, p, n);
 }
 
@@ -90,6 +91,7 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  prefault(myproc(), p, n);
 
   return filewrite(f, p, n);
 }
@@ -305,7 +307,7 @@ uint64
 sys_open(void)
 {
   char path[MAXPATH];
-  int fd, omode;
+  int fd, omode, writable, busy;
   struct file *f;
   struct inode *ip;
   int n;
@@ -341,9 +343,21 @@ sys_open(void)
     return -1;
   }
 
+  // a file that some process runs as its program
+  // cannot be written or truncated; see idenywrite().
+  writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  busy = ip->type == T_FILE && (writable || (omode & O_TRUNC));
+  if(busy && igetwrite(ip) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
+    if(busy)
+      iputwrite(ip);
     iunlockput(ip);
     end_op();
     return -1;
@@ -354,15 +368,19 @@ sys_open(void)
     f->major = ip->major;
   } else {
     f->type = FD_INODE;
-    f->off = 0;
   }
+  f->off = 0; // devices with readat use it too
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
-  f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->writable = writable;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
+  // fileclose() undoes igetwrite() only for a file that
+  // can write.
+  if(busy && !writable)
+    iputwrite(ip);
 
   iunlock(ip);
   end_op();
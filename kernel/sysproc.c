@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sem.h"
 
 uint64
 sys_exit(void)
@@ -32,6 +33,7 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
+  prefault(myproc(), p, sizeof(int));
   return wait(p);
 }
 
@@ -53,20 +55,30 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct timeout t;
 
   argint(0, &n);
+  ticks0 = curticks();
+
+  // sleep on a timeout, not on &ticks, so clockintr()
+  // wakes only this process, and only at the deadline.
+  t.deadline = ticks0 + n;
+  t.proc = myproc();
+  t.chan = &t;
+  timeout_add(&t);
   acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n)
+  while (curticks() - ticks0 < n)
   {
     if (killed(myproc()))
     {
       release(&tickslock);
+      timeout_del(&t);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
+  timeout_del(&t);
   return 0;
 }
 
@@ -79,17 +91,54 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+uint64
+sys_setaffinity(void)
+{
+  int mask;
+
+  argint(0, &mask);
+  return setaffinity(mask);
+}
+
+uint64
+sys_setquantum(void)
+{
+  int pid, cycles;
+
+  argint(0, &pid);
+  argint(1, &cycles);
+  if(cycles < 0)
+    return -1;
+  return setquantum(pid, cycles);
+}
+
+uint64
+sys_setrt(void)
+{
+  int period, budget;
+
+  argint(0, &period);
+  argint(1, &budget);
+  if(period < 0 || budget < 0)
+    return -1;
+  return setrt(period, budget);
+}
+
+uint64
+sys_setgang(void)
+{
+  int gang;
+
+  argint(0, &gang);
+  return setgang(gang);
+}
+
+// return how many clock ticks have elapsed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return curticks();
 }
 
 // NUEVAS FUNCIONES DE SEMAFOROS AGREGADAS
@@ -102,6 +151,13 @@ uint64 sys_sem_open(void)
   return sem_open(arg_id_sem, arg_value);
 }
 
+uint64 sys_sem_create(void)
+{
+  int arg_value;
+  argint(0, &arg_value);
+  return sem_create(arg_value);
+}
+
 uint64 sys_sem_close(void)
 {
   int arg_id_sem;
@@ -122,3 +178,91 @@ uint64 sys_sem_down(void)
   argint(0, &arg_id_sem);
   return sem_down(arg_id_sem);
 }
+
+uint64 sys_sem_trydown(void)
+{
+  int arg_id_sem;
+  argint(0, &arg_id_sem);
+  return sem_trydown(arg_id_sem);
+}
+
+uint64 sys_sem_timeddown(void)
+{
+  int arg_id_sem, arg_deadline;
+  argint(0, &arg_id_sem);
+  argint(1, &arg_deadline);
+  return sem_timeddown(arg_id_sem, arg_deadline);
+}
+
+uint64 sys_sem_op(void)
+{
+  struct sem_op ops[SEM_OPMAX];
+  uint64 arg_ops;
+  int arg_nops;
+  argaddr(0, &arg_ops);
+  argint(1, &arg_nops);
+  if (arg_nops < 1 || arg_nops > SEM_OPMAX)
+    return -1;
+  if (copyin(myproc()->pagetable, (char *)ops, arg_ops, arg_nops * sizeof(struct sem_op)) < 0)
+    return -1;
+  return sem_op(ops, arg_nops);
+}
+
+uint64 sys_mutex_create(void)
+{
+  return mutex_create();
+}
+
+uint64 sys_mutex_lock(void)
+{
+  int arg_id_sem;
+  argint(0, &arg_id_sem);
+  return mutex_lock(arg_id_sem);
+}
+
+uint64 sys_mutex_unlock(void)
+{
+  int arg_id_sem;
+  argint(0, &arg_id_sem);
+  return mutex_unlock(arg_id_sem);
+}
+
+uint64 sys_futex_wait(void)
+{
+  uint64 arg_addr;
+  int arg_val;
+  argaddr(0, &arg_addr);
+  argint(1, &arg_val);
+  return futex_wait(arg_addr, arg_val);
+}
+
+uint64 sys_futex_wake(void)
+{
+  uint64 arg_addr;
+  int arg_n;
+  argaddr(0, &arg_addr);
+  argint(1, &arg_n);
+  return futex_wake(arg_addr, arg_n);
+}
+
+// grow the heap by n pages that fork() shares
+// with children instead of copying.
+// returns the address of the first page.
+uint64
+sys_mapshared(void)
+{
+  struct proc *p = myproc();
+  uint64 addr, sz;
+  int n;
+
+  argint(0, &n);
+  if(n <= 0)
+    return -1;
+  addr = PGROUNDUP(p->sz);
+  if(addr + (uint64)n*PGSIZE > TRAPFRAME)
+    return -1;
+  if((sz = uvmalloc(p->pagetable, addr, addr + (uint64)n*PGSIZE, PTE_W|PTE_S)) == 0)
+    return -1;
+  p->sz = sz;
+  return addr;
+}
@@ -0,0 +1,130 @@
+// TRAZA DEL PLANIFICADOR
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "trace.h"
+
+#define NTRACE 256 // Eventos que guarda cada CPU (los más viejos se pisan).
+
+// Codigos de retorno.
+#define ERROR_CODE -1
+
+/* Buffer circular de eventos de una CPU.
+ *
+ * Solo escribe la CPU dueña (con las interrupciones apagadas), sin locks: llena
+ * el evento y después avanza `head`. Los lectores se ordenan entre sí con
+ * trace_lock y detectan los eventos que se pisaron mientras los copiaban.
+ */
+struct tracering
+{
+  uint64 head;                  // Eventos escritos desde el arranque.
+  uint64 tail;                  // Eventos ya leídos (protegido por trace_lock).
+  struct schedevent ev[NTRACE]; // El evento `i` está en `ev[i % NTRACE]`.
+} __attribute__((aligned(CACHELINE)));
+
+struct tracering tracerings[NCPU];
+struct sleeplock trace_lock; // Un lector a la vez.
+
+/* ------------- Funciones solo para el KERNEL ---------------*/
+
+/* Registra un evento del planificador en el buffer de esta CPU.
+ *
+ * PARAMS:
+ *   - type: Qué ocurrió (SCHED_*).
+ *   - p:    Proceso al que le ocurrió.
+ *   - chan: Canal (solo para SCHED_SLEEP).
+ */
+void trace_event(int type, struct proc *p, void *chan)
+{
+  struct tracering *r;
+  struct schedevent *e;
+
+  push_off(); // Que no nos muevan de CPU ni nos interrumpa otro evento a medias.
+  r = &tracerings[cpuid()];
+  e = &r->ev[r->head % NTRACE];
+  e->time = readmtime();
+  e->chan = (uint64)chan;
+  e->pid = p->pid;
+  e->cpu = cpuid();
+  e->type = type;
+  __sync_synchronize(); // El evento queda completo antes de publicarlo.
+  r->head++;
+  pop_off();
+}
+
+/* Saca eventos de todos los buffers (dispositivo SCHEDTRACE).
+ *
+ * Los eventos leídos se consumen. Se devuelven en orden de `time`, mezclando
+ * los buffers de todas las CPUs. Los que se pisaron antes de leerlos se pierden.
+ * Solo se devuelven eventos completos.
+ *
+ * PARAMS:
+ *   - user_dst: `1` si `dst` es una dirección de usuario.
+ *   - dst:      Dónde copiar los eventos.
+ *   - n:        Cantidad máxima de bytes a leer.
+ *
+ * RETURN:
+ *   - La cantidad de bytes leídos (`0` si no hay eventos nuevos).
+ *   - `-1` en caso de error.
+ */
+static int schedtraceread(int user_dst, uint64 dst, int n)
+{
+  struct tracering *r, *first;
+  struct schedevent e;
+  uint64 head;
+  int got = 0;
+
+  acquiresleep(&trace_lock);
+  while (got + (int)sizeof(e) <= n)
+  {
+    // La CPU con el evento pendiente más viejo.
+    first = 0;
+    for (r = tracerings; r < &tracerings[NCPU]; r++)
+    {
+      head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      // Se pisaron (o se están pisando: el evento `head` se escribe en el
+      // lugar de `head - NTRACE`): se saltean.
+      if (head - r->tail >= NTRACE)
+        r->tail = head - NTRACE + 1;
+      if (r->tail == head)
+        continue;
+      if (first == 0 || r->ev[r->tail % NTRACE].time < first->ev[first->tail % NTRACE].time)
+        first = r;
+    }
+    if (first == 0)
+      break;
+
+    e = first->ev[first->tail % NTRACE];
+    __sync_synchronize();
+    head = first->head;
+    first->tail++;
+    if (head - (first->tail - 1) >= NTRACE)
+      continue; // Se pisó (o se empezó a pisar) mientras se copiaba.
+
+    if (either_copyout(user_dst, dst + got, &e, sizeof(e)) < 0)
+    {
+      releasesleep(&trace_lock);
+      return ERROR_CODE;
+    }
+    got += sizeof(e);
+  }
+  releasesleep(&trace_lock);
+
+  return got;
+}
+
+/* Inicializa la traza del planificador (KERNEL).
+ * Conecta el dispositivo SCHEDTRACE, como consoleinit con la consola.
+ */
+void init_trace()
+{
+  initsleeplock(&trace_lock, "trace");
+  devsw[SCHEDTRACE].read = schedtraceread;
+}
@@ -0,0 +1,17 @@
+// Evento del planificador, como se leen del dispositivo SCHEDTRACE
+// (ordenados por `time`).
+struct schedevent
+{
+  uint64 time; // CLINT_MTIME cuando ocurrió.
+  uint64 chan; // SCHED_SLEEP: canal en el que se durmió.
+  int pid;     // Proceso.
+  short cpu;   // CPU en la que ocurrió.
+  short type;  // Qué ocurrió (SCHED_*).
+};
+
+#define SCHED_WAKEUP 1   // Pasó a RUNNABLE (despertado, recién creado o matado).
+#define SCHED_YIELD 2    // Dejó la CPU quedando RUNNABLE (fin del quantum o preempción).
+#define SCHED_DISPATCH 3 // El scheduler lo eligió, justo antes del swtch.
+#define SCHED_RUN 4      // Volvió a ejecutar, justo después del swtch.
+#define SCHED_SLEEP 5    // Se durmió en `chan`.
+#define SCHED_EXIT 6     // Terminó.
@@ -8,6 +8,11 @@
 
 struct spinlock tickslock;
 uint ticks;
+struct timeout *timeouts; // pending timeouts, earliest first.
+uint64 nexttimeout;       // mtime of timeouts' deadline, 0 if none.
+#ifdef MLFQ
+uint lastboost;           // ticks at the last prioboost().
+#endif
 
 extern char trampoline[], uservec[], userret[];
 
@@ -37,6 +42,7 @@ void
 usertrap(void)
 {
   int which_dev = 0;
+  pte_t *pte;
 
   if((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
@@ -67,6 +73,26 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            pagein(p, r_stval(), 1) == 0){
+    // first touch of a program or sbrk() page.
+  } else if(r_scause() == 15 && uvmcow(p->pagetable, r_stval()) == 0){
+    // store to a copy-on-write page; now it is private.
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            r_stval() < p->sz &&
+            ((pte = walk(p->pagetable, r_stval(), 0)) == 0 ||
+             (*pte & PTE_V) == 0 || (*pte & PTE_COW))){
+    // a page of the process that pagein() or uvmcow()
+    // could not fill: out of memory, not a bug in the
+    // program, so kill it without the report below.
+    setkilled(p);
+  } else if(r_scause() == 2 && !p->fpused){
+    // illegal instruction with the FP unit off: the
+    // process's first FP instruction. give it zeroed
+    // FP registers (usertrapret loads them) and retry.
+    memset(&p->fp, 0, sizeof(p->fp));
+    p->fpcpu = -1;
+    p->fpused = 1;
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,9 +102,13 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if this is a timer interrupt
+  // and the process's quantum is used up.
   if(which_dev == 2)
-    yield();
+    timertick();
+
+  // or if a real-time process is waiting for this cpu.
+  preemptcheck();
 
   usertrapret();
 }
@@ -110,6 +140,9 @@ usertrapret(void)
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
+  // FP registers, or the FP unit off if p does not use it.
+  fpload(p);
+
   // set S Previous Privilege mode to User.
   unsigned long x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
@@ -150,9 +183,12 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if this is a timer interrupt
+  // and the process's quantum is used up.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    timertick();
+  if(myproc() != 0 && myproc()->state == RUNNING)
+    preemptcheck();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,12 +196,169 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// The current tick, straight from the CLINT's mtime.
+// Unlike ticks, it does not wait for some hart to take
+// a clock interrupt, which with TICKLESS may be long
+// after the tick boundary.
+uint
+curticks(void)
+{
+  return readmtime() / TICKCYCLES;
+}
+
+// Publish the deadline of the earliest timeout for
+// nextdeadline(). Caller must hold tickslock.
+static void
+timeoutnext(void)
+{
+  uint64 when = timeouts ? (uint64)timeouts->deadline * TICKCYCLES : 0;
+
+  __atomic_store_n(&nexttimeout, when, __ATOMIC_RELAXED);
+}
+
+// ticks is derived from the CLINT's mtime, so it catches up
+// with the time elapsed at the next interrupt on any hart,
+// but it is only updated when some hart takes one (with
+// TICKLESS, possibly long after a tick boundary).
+// any hart may call this; it only does work once per tick.
 void
 clockintr()
 {
+  struct timeout **tp, *t;
+  uint now = curticks();
+
+  if(now == ticks)
+    return;
+  acquire(&tickslock);
+  if((int)(now - ticks) <= 0){
+    // another hart got here first.
+    release(&tickslock);
+    return;
+  }
+  ticks = now;
+
+  // wake the expired timeouts. a process that hasn't
+  // gone to sleep yet keeps its entry until the next tick.
+  tp = &timeouts;
+  while((t = *tp) != 0 && (int)(ticks - t->deadline) >= 0){
+    if(wakeproc(t->proc, t->chan)){
+      *tp = t->next;
+      t->armed = 0;
+    } else {
+      tp = &t->next;
+    }
+  }
+  timeoutnext();
+#ifdef MLFQ
+  int boost = ticks - lastboost >= BOOSTTICKS;
+  if(boost)
+    lastboost = ticks;
+  release(&tickslock);
+  if(boost)
+    prioboost();
+#else
+  release(&tickslock);
+#endif
+}
+
+// Arrange for t->proc to be woken up from a sleep
+// on t->chan once ticks reaches t->deadline.
+// The caller must timeout_del(t) before t goes away.
+void
+timeout_add(struct timeout *t)
+{
+  struct timeout **tp;
+
+  acquire(&tickslock);
+  for(tp = &timeouts; *tp && (int)((*tp)->deadline - t->deadline) <= 0; tp = &(*tp)->next)
+    ;
+  t->next = *tp;
+  *tp = t;
+  t->armed = 1;
+  timeoutnext();
+#ifdef TICKLESS
+  // the new earliest timeout: a one-shot timer armed
+  // before it may not fire until long after it. this
+  // hart arms its timer for it; whatever runs here next
+  // keeps it armed (see slicearm() and the idle loop).
+  if(tp == &timeouts)
+    timerarmby(nexttimeout);
+#endif
+  release(&tickslock);
+}
+
+// The CLINT mtime at which the earliest pending
+// timeout expires, or 0 if there are none. A timeout
+// that has expired but is still pending (its process
+// had not gone to sleep yet) is retried at the next
+// tick, not right away, so arming it cannot storm.
+// Takes no lock, so callers may hold p->lock (which
+// clockintr() takes under tickslock).
+uint64
+nextdeadline(void)
+{
+  uint64 when, now;
+
+  when = __atomic_load_n(&nexttimeout, __ATOMIC_RELAXED);
+  now = readmtime();
+  if(when && when <= now)
+    when = (now / TICKCYCLES + 1) * TICKCYCLES;
+  return when;
+}
+
+// Cycles since boot, from the CLINT.
+uint64
+readmtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
+// Program this hart's next timer interrupt for mtime when
+// (one-shot, see timervec). 0 disarms the timer.
+// Interrupts must be disabled.
+void
+timerarm(uint64 when)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when ? when : -1;
+}
+
+// Make hart id take a timer interrupt right away, to pull
+// it out of wfi. Only for one-shot timers: a periodic
+// timer would fire once per missed interval.
+void
+timerkick(int id)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(id) = 0;
+}
+
+// Make this hart's next timer interrupt come no later
+// than mtime when. With a periodic timer, the ones after
+// it keep the TICKCYCLES interval from there on; ticks
+// is derived from mtime, so it is not affected.
+// Interrupts must be disabled.
+void
+timerarmby(uint64 when)
+{
+  volatile uint64 *cmp = (uint64*)CLINT_MTIMECMP(cpuid());
+
+  if(when < *cmp)
+    *cmp = when;
+}
+
+// Cancel t if it hasn't fired yet.
+void
+timeout_del(struct timeout *t)
+{
+  struct timeout **tp;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if(t->armed){
+    for(tp = &timeouts; *tp != t; tp = &(*tp)->next)
+      ;
+    *tp = t->next;
+    t->armed = 0;
+    timeoutnext();
+  }
   release(&tickslock);
 }
 
@@ -205,9 +398,16 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    clockintr();
+
+#ifdef TICKLESS
+    // one-shot: a busy hart needs a timer for the rest of
+    // its process's slice, or for the earliest timeout if
+    // that comes first. the scheduler programs idle
+    // harts itself.
+    if(mycpu()->proc)
+      slicearm(mycpu()->proc);
+#endif
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
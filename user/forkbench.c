@@ -0,0 +1,116 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+/* Un trabajador: hace `rounds` veces fork + exec de este mismo programa
+ * (que termina enseguida) y espera al hijo.
+ */
+void worker(int rounds)
+{
+    char *argv[] = {"forkbench", "-", 0};
+    int status;
+
+    for (int i = 0; i < rounds; i++)
+    {
+        int pid = fork();
+        if (pid < 0)
+            exit(1);
+        if (pid == 0)
+        {
+            exec("forkbench", argv);
+            exit(1);
+        }
+        if (wait(&status) < 0 || status != 0)
+            exit(1);
+    }
+    exit(0);
+}
+
+/* Corre `workers` trabajadores en paralelo, el i-ésimo fijo en la CPU i % NCPU
+ * (si esa CPU no arrancó, setaffinity falla y el trabajador corre en cualquiera).
+ *
+ * RETURN:
+ *   - Los ticks que tardó hasta que terminaron todos.
+ *   - `-1` en caso de error.
+ */
+int run(int workers, int rounds)
+{
+    int status, failed = 0;
+
+    int start = uptime();
+    for (int i = 0; i < workers; i++)
+    {
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf("ERROR: Fallo el fork.\n");
+            failed = 1;
+            break;
+        }
+        if (pid == 0)
+        {
+            setaffinity(1 << (i % NCPU));
+            worker(rounds);
+        }
+    }
+    while (wait(&status) >= 0)
+        if (status != 0)
+            failed = 1;
+    int ticks = uptime() - start;
+
+    return failed ? -1 : ticks;
+}
+
+/* ForkBench
+ *
+ * Mide cómo escalan fork y exec (y con ellos el allocator de páginas): corre
+ * 1, 2, ..., P trabajadores en paralelo, cada uno en su propia CPU, que hacen
+ * R veces fork + exec + wait, y muestra cuántos ticks tardó cada prueba. Si
+ * nada se serializa, el tiempo debería mantenerse mientras haya harts libres
+ * (ver `make CPUS=...`).
+ *
+ * PARAMS:
+ * - P: Cantidad máxima de trabajadores (opcional, NCPU por defecto).
+ * - R: Rondas de cada trabajador (opcional, 100 por defecto).
+ *
+ * Ejemplo de uso:
+ *
+ * $ forkbench 2 100
+ * trabajadores 1: 30 ticks
+ * trabajadores 2: 31 ticks
+ */
+int main(int argc, char *argv[])
+{
+    int workers = NCPU, rounds = 100;
+
+    if (argc == 2 && strcmp(argv[1], "-") == 0)
+        exit(0); // Somos el programa que ejecutan los trabajadores.
+
+    if (argc > 1)
+        workers = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (argc > 3 || workers <= 0 || rounds <= 0)
+    {
+        printf("ERROR: uso: forkbench [P] [R], con P, R > 0.\n");
+        exit(1);
+    }
+    // Un fork que falla por falta de procesos arruinaría la medición: cada
+    // trabajador vive junto con el hijo que está esperando, y además corren
+    // init, sh y este forkbench.
+    if (2 * workers > NPROC - 3)
+        workers = (NPROC - 3) / 2;
+
+    for (int w = 1; w <= workers; w++)
+    {
+        int ticks = run(w, rounds);
+        if (ticks < 0)
+        {
+            printf("ERROR: Fallo un trabajador.\n");
+            exit(1);
+        }
+        printf("trabajadores %d: %d ticks\n", w, ticks);
+    }
+
+    exit(0);
+}
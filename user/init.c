@@ -23,6 +23,11 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // devices read by semstat and schedlat.
+  mkdir("/dev");
+  mknod("/dev/semstat", SEMSTAT, 0);
+  mknod("/dev/schedtrace", SCHEDTRACE, 0);
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
@@ -1,33 +1,7 @@
 #include "kernel/types.h"
+#include "kernel/sem.h"
 #include "user/user.h"
 
-/* Crear un semaforo nuevo.
- *
- * Itera hasta encontrar un semaforo disponible.
- *
- * PARAMS:
- *   - value: Número con que inicializar el semaforo.
- *
- * RETURN:
- *   - En caso de devuelde el `Id` del semaforo creado.
- *   - `-1` en caso de error.
- */
-int create_sem(int value)
-{
-    int SEM_ID = 0;
-
-    // Bucle para encontrar un semaforo abierto
-    int res_sem = sem_open(SEM_ID, value);
-    /* Si el semaforo da error o no esta abierto, prueba con el siguiente */
-    while (res_sem == -1 || res_sem == 1)
-    {
-        SEM_ID++;
-        res_sem = sem_open(SEM_ID, value);
-    }
-
-    return SEM_ID;
-}
-
 /* PingPong
  *
  * Este programa toma un argumento entero N (rally) que determina la cantidad de veces que se imprimirán las
@@ -57,8 +31,8 @@ int main(int argc, char *argv[])
         return 0;
 
     // Incializo los semaforos
-    int SEM_PING = create_sem(1);
-    int SEM_PONG = create_sem(0);
+    int SEM_PING = sem_create(1);
+    int SEM_PONG = sem_create(0);
 
     // En caso de error terminamos el programa
     if (SEM_PING == -1 || SEM_PONG == -1)
@@ -67,6 +41,10 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // Los dos hijos se pasan el turno todo el tiempo: se los agrupa para que
+    // corran en la misma CPU (lo heredan del padre).
+    setgang(getpid());
+
     int pc_id_1,
         pc_id_2;
 
@@ -78,14 +56,17 @@ int main(int argc, char *argv[])
     }
     else if (pc_id_1 == 0) // Si es el primer hijo
     {
-        int status_pong = 0, status_ping = 0; // Variables para controlar los errores de los semaforos.
+        struct sem_op handoff[2] = {{SEM_PONG, 1}, {SEM_PING, -1}}; // Le aviso a PONG y espero que me active.
 
         // La primera vez (i = 0) ejecuta PING porque se inicializo en 1 el semaforo.
-        for (int i = 0; (i < num) && status_pong == 0 && status_ping == 0; i++)
+        int status = sem_down(SEM_PING); // Variable para controlar los errores de los semaforos.
+        for (int i = 0; (i < num) && status == 0; i++)
         {
-            status_ping = sem_down(SEM_PING); // Espero que PONG me active
             printf("ping\n");
-            status_pong = sem_up(SEM_PONG); // Le aviso a PONG que ya puede escribir
+            if (i == num - 1)
+                status = sem_up(SEM_PONG); // Ultima ronda: solo le aviso a PONG que ya puede escribir
+            else
+                status = sem_op(handoff, 2); // Le aviso a PONG y espero que me active, en una sola llamada
         }
     }
     else
@@ -98,14 +79,17 @@ int main(int argc, char *argv[])
         }
         else if (pc_id_2 == 0 && pc_id_1 > 0) // Si es el segundo hijo
         {
-            int status_pong = 0, status_ping = 0; // Variables para controlar los errores de los semaforos.
+            struct sem_op handoff[2] = {{SEM_PING, 1}, {SEM_PONG, -1}}; // Le aviso a PING y espero que me active.
 
             // La primera vez (i = 0) se esta esperando que PING active el PONG porque el semaforo empezo en 0.
-            for (int i = 0; (i < num) && status_pong == 0 && status_ping == 0; i++)
+            int status = sem_down(SEM_PONG); // Variable para controlar los errores de los semaforos.
+            for (int i = 0; (i < num) && status == 0; i++)
             {
-                status_pong = sem_down(SEM_PONG); // Espero que PING me active
                 printf("    pong\n");
-                status_ping = sem_up(SEM_PING); // Le aviso a PING que ya puede escribir
+                if (i == num - 1)
+                    status = sem_up(SEM_PING); // Ultima ronda: solo le aviso a PING que ya puede escribir
+                else
+                    status = sem_op(handoff, 2); // Le aviso a PING y espero que me active, en una sola llamada
             }
         }
         else
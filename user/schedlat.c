@@ -0,0 +1,171 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define CHUNK 64    // Eventos leídos por cada read.
+#define NSLOT 64    // Procesos seguidos a la vez (por pid % NSLOT).
+#define NBUCKET 31  // Barras del histograma: [2^i, 2^(i+1)) ciclos.
+#define WIDTH 40    // Largo de la barra más larga.
+
+// Lo que se sabe de un proceso entre eventos.
+struct slot
+{
+    int pid;
+    uint64 queued;     // Cuándo quedó RUNNABLE (`0` si no está en una cola).
+    uint64 dispatched; // Cuándo lo eligió el scheduler (`0` si no hay swtch pendiente).
+};
+
+// Globales y no en el stack de main, que tiene una sola página.
+struct schedevent buf[CHUNK];
+struct slot slots[NSLOT];
+int rqdelay[NBUCKET]; // Tiempo en la cola de listos (WAKEUP/YIELD -> DISPATCH).
+int swtchtime[NBUCKET]; // Tiempo del cambio de contexto (DISPATCH -> RUN).
+int events, unknown;
+
+/* Devuelve el estado del proceso `pid`, reciclando el lugar si era de otro. */
+struct slot *slotof(int pid)
+{
+    struct slot *s = &slots[pid % NSLOT];
+    if (s->pid != pid)
+    {
+        s->pid = pid;
+        s->queued = 0;
+        s->dispatched = 0;
+    }
+    return s;
+}
+
+/* Suma una medición (en ciclos de CLINT_MTIME) al histograma `h`. */
+void account(int *h, uint64 cycles)
+{
+    int i = 0;
+    while (i < NBUCKET - 1 && cycles >= (2UL << i))
+        i++;
+    h[i]++;
+}
+
+/* Procesa un evento de la traza. */
+void consume(struct schedevent *e)
+{
+    struct slot *s = slotof(e->pid);
+
+    events++;
+    switch (e->type)
+    {
+    case SCHED_WAKEUP:
+    case SCHED_YIELD:
+        s->queued = e->time;
+        break;
+    case SCHED_DISPATCH:
+        if (s->queued)
+            account(rqdelay, e->time - s->queued);
+        s->queued = 0;
+        s->dispatched = e->time;
+        break;
+    case SCHED_RUN:
+        if (s->dispatched)
+            account(swtchtime, e->time - s->dispatched);
+        s->dispatched = 0;
+        break;
+    case SCHED_SLEEP:
+    case SCHED_EXIT:
+        s->queued = 0;
+        s->dispatched = 0;
+        break;
+    default:
+        unknown++;
+    }
+}
+
+/* Imprime un histograma, salteando las barras vacías de los extremos. */
+void histogram(char *title, int *h)
+{
+    int lo = 0, hi = NBUCKET - 1, max = 0, total = 0;
+
+    for (int i = 0; i < NBUCKET; i++)
+    {
+        total += h[i];
+        if (h[i] > max)
+            max = h[i];
+    }
+    printf("%s (%d muestras, en ciclos):\n", title, total);
+    if (total == 0)
+        return;
+
+    while (h[lo] == 0)
+        lo++;
+    while (h[hi] == 0)
+        hi--;
+    for (int i = lo; i <= hi; i++)
+    {
+        printf("  >= %d: %d ", i == 0 ? 0 : 1 << i, h[i]);
+        for (int j = 0; j < (h[i] * WIDTH + max - 1) / max; j++)
+            printf("*");
+        printf("\n");
+    }
+}
+
+/* SchedLat
+ *
+ * Lee la traza del planificador durante T ticks y muestra los histogramas
+ * (log2, en ciclos de CLINT_MTIME) de:
+ *   - cuánto espera un proceso en la cola de listos hasta que lo eligen, y
+ *   - cuánto tarda el swtch desde el scheduler hasta el proceso.
+ *
+ * Cada CPU guarda solo sus últimos eventos: si hay mucha actividad, conviene
+ * leer seguido (T chico) o se pierden mediciones.
+ *
+ * PARAMS:
+ * - T: Ticks a medir (opcional, 10 por defecto).
+ *
+ * Ejemplo de uso:
+ *
+ * $ schedlat 10 & pingpong 100
+ * ...
+ * demora en la cola (120 muestras, en ciclos):
+ *   >= 1024: 3 ***
+ *   >= 2048: 40 ****************************************
+ */
+int main(int argc, char *argv[])
+{
+    int t = 10, fd, r;
+
+    if (argc > 2 || (argc == 2 && (t = atoi(argv[1])) <= 0))
+    {
+        printf("ERROR: uso: schedlat [T], con T > 0.\n");
+        exit(1);
+    }
+
+    if ((fd = open("/dev/schedtrace", O_RDONLY)) < 0) // Lo crea init.
+    {
+        printf("ERROR: No se pudo abrir /dev/schedtrace.\n");
+        exit(1);
+    }
+
+    // Se descarta lo que quedó de antes, para medir solo estos T ticks.
+    // Un read incompleto indica que se alcanzó a los que escriben.
+    while (read(fd, buf, sizeof(buf)) == sizeof(buf))
+        ;
+
+    for (int i = 0; i < t; i++)
+    {
+        sleep(1);
+        do
+        {
+            r = read(fd, buf, sizeof(buf));
+            for (int j = 0; j < r / (int)sizeof(struct schedevent); j++)
+                consume(&buf[j]);
+        } while (r == sizeof(buf));
+    }
+    close(fd);
+
+    printf("%d eventos", events);
+    if (unknown)
+        printf(" (%d desconocidos)", unknown);
+    printf("\n");
+    histogram("demora en la cola", rqdelay);
+    histogram("swtch", swtchtime);
+
+    exit(0);
+}
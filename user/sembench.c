@@ -0,0 +1,114 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/sem.h"
+#include "user/user.h"
+
+/* Un jugador de un par: baja su semáforo y le pasa el turno al otro, `rounds` veces.
+ *
+ * El que arranca (`first`) tiene su semáforo en 1, así que nunca se bloquean
+ * los dos a la vez.
+ */
+void player(int mine, int other, int rounds)
+{
+    struct sem_op handoff[2] = {{other, 1}, {mine, -1}}; // Le paso el turno al otro y espero el mío.
+
+    int status = sem_down(mine);
+    for (int i = 0; i < rounds && status == 0; i++)
+    {
+        if (i == rounds - 1)
+            status = sem_up(other); // Ultima ronda: solo le paso el turno.
+        else
+            status = sem_op(handoff, 2);
+    }
+    exit(status == 0 ? 0 : 1);
+}
+
+/* Corre `pairs` pares independientes de pingpong en paralelo.
+ *
+ * RETURN:
+ *   - Los ticks que tardó hasta que terminaron todos.
+ *   - `-1` en caso de error.
+ */
+int run(int pairs, int rounds)
+{
+    int sems[2 * NPROC], status, failed = 0;
+
+    for (int i = 0; i < 2 * pairs; i++)
+    {
+        if ((sems[i] = sem_create(i % 2 == 0)) < 0)
+        {
+            printf("ERROR: No se logro crear los semaforos.\n");
+            for (int j = 0; j < i; j++)
+                sem_close(sems[j]);
+            return -1;
+        }
+    }
+
+    int start = uptime();
+    for (int i = 0; i < 2 * pairs; i++)
+    {
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf("ERROR: Fallo el fork.\n");
+            failed = 1;
+            break;
+        }
+        if (pid == 0)
+            player(sems[i], sems[i ^ 1], rounds);
+    }
+    // Si falló un fork, cerrar los semáforos despierta a los que quedaron esperando.
+    if (failed)
+        for (int i = 0; i < 2 * pairs; i++)
+            sem_close(sems[i]);
+    while (wait(&status) >= 0)
+        if (status != 0)
+            failed = 1;
+    int ticks = uptime() - start;
+
+    if (!failed)
+        for (int i = 0; i < 2 * pairs; i++)
+            sem_close(sems[i]);
+
+    return failed ? -1 : ticks;
+}
+
+/* SemBench
+ *
+ * Mide cómo escalan los semáforos: corre 1, 2, ..., P pares de pingpong
+ * independientes (cada par con sus propios semáforos) y muestra cuántos ticks
+ * tardó cada prueba. Con semáforos que no comparten líneas de cache, el tiempo
+ * debería mantenerse mientras haya harts libres (ver `make CPUS=...`).
+ *
+ * PARAMS:
+ * - P: Cantidad máxima de pares (opcional, NCPU por defecto).
+ * - R: Rondas de cada par (opcional, 1000 por defecto).
+ *
+ * Ejemplo de uso:
+ *
+ * $ sembench 2 1000
+ * pares 1: 12 ticks
+ * pares 2: 13 ticks
+ */
+int main(int argc, char *argv[])
+{
+    int pairs = NCPU, rounds = 1000;
+
+    if (argc > 3 || (argc > 1 && (pairs = atoi(argv[1])) <= 0) || (argc > 2 && (rounds = atoi(argv[2])) <= 0))
+    {
+        printf("ERROR: uso: sembench [P] [R], con P, R > 0.\n");
+        exit(1);
+    }
+    if (pairs > NPROC / 2 - 2) // Dos procesos por par, dejando lugar para init, sh y sembench.
+        pairs = NPROC / 2 - 2;
+
+    for (int p = 1; p <= pairs; p++)
+    {
+        int ticks = run(p, rounds);
+        if (ticks < 0)
+            exit(1);
+        printf("pares %d: %d ticks\n", p, ticks);
+    }
+
+    exit(0);
+}
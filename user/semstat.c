@@ -0,0 +1,107 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/sem.h"
+#include "user/user.h"
+
+#define MAX_TOP 64   // Máxima cantidad de semáforos a mostrar.
+#define CHUNK 32     // Registros leídos por cada read.
+
+// Globales y no en el stack de main, que tiene una sola página.
+struct semstat top[MAX_TOP]; // Los más calientes, ordenados.
+struct semstat buf[CHUNK];   // Registros leídos del dispositivo.
+
+/* Indica si el semáforo `a` está más "caliente" que `b`.
+ *
+ * Ordena por ticks dormidos, después por veces que se durmió y por último
+ * por cantidad de operaciones.
+ */
+int hotter(struct semstat *a, struct semstat *b)
+{
+    if (a->blockticks != b->blockticks)
+        return a->blockticks > b->blockticks;
+    if (a->blocked != b->blocked)
+        return a->blocked > b->blocked;
+    return a->ups + a->downs > b->ups + b->downs;
+}
+
+/* Imprime `v` alineado a la derecha en `width` columnas. */
+void printcol(uint v, int width)
+{
+    char buf[16];
+    int n = 0;
+
+    do
+    {
+        buf[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0 && n < sizeof(buf));
+    for (int i = n; i < width; i++)
+        printf(" ");
+    while (n > 0)
+        printf("%c", buf[--n]);
+}
+
+/* SemStat
+ *
+ * Muestra los N semáforos abiertos con más contención, según las estadísticas
+ * que lleva el kernel (ver struct semstat).
+ *
+ * PARAMS:
+ * - N: Cantidad de semáforos a mostrar (opcional, 10 por defecto).
+ *
+ * Ejemplo de uso:
+ *
+ * $ semstat 2
+ *     id value  wait      ups    downs  blocked    ticks  maxwait
+ *      0     0     1      120      121       60        8        1
+ *      1     1     0      120      119       59        7        1
+ */
+int main(int argc, char *argv[])
+{
+    int ntop = 0, max = 10, fd, r;
+
+    if (argc > 2 || (argc == 2 && ((max = atoi(argv[1])) <= 0 || max > MAX_TOP)))
+    {
+        printf("ERROR: uso: semstat [N], con 0 < N <= %d.\n", MAX_TOP);
+        exit(1);
+    }
+
+    if ((fd = open("/dev/semstat", O_RDONLY)) < 0) // Lo crea init.
+    {
+        printf("ERROR: No se pudo abrir /dev/semstat.\n");
+        exit(1);
+    }
+
+    // Se leen todos los registros quedándose con los `max` más calientes (ordenados).
+    while ((r = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (int i = 0; i < r / sizeof(struct semstat); i++)
+        {
+            if (!buf[i].open)
+                continue;
+            int j = ntop < max ? ntop++ : max;
+            for (; j > 0 && hotter(&buf[i], &top[j - 1]); j--)
+                if (j < max)
+                    top[j] = top[j - 1];
+            if (j < max)
+                top[j] = buf[i];
+        }
+    }
+    close(fd);
+
+    printf("    id value  wait      ups    downs  blocked    ticks  maxwait\n");
+    for (int i = 0; i < ntop; i++)
+    {
+        printcol(top[i].id, 6);
+        printcol(top[i].value, 6);
+        printcol(top[i].waiters, 6);
+        printcol(top[i].ups, 9);
+        printcol(top[i].downs, 9);
+        printcol(top[i].blocked, 9);
+        printcol(top[i].blockticks, 9);
+        printcol(top[i].maxwaiters, 9);
+        printf("\n");
+    }
+
+    exit(0);
+}
@@ -145,3 +145,38 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+void
+usem_init(struct usem *s, int value)
+{
+  s->value = value;
+  s->waiters = 0;
+}
+
+void
+usem_up(struct usem *s)
+{
+  __sync_fetch_and_add(&s->value, 1);
+  if(s->waiters > 0)
+    futex_wake(&s->value, 1);
+}
+
+void
+usem_down(struct usem *s)
+{
+  int v;
+
+  for(;;){
+    v = s->value;
+    if(v > 0){
+      if(__sync_bool_compare_and_swap(&s->value, v, v - 1))
+        return;
+      continue;
+    }
+    // futex_wait only sleeps if value is still 0, so an
+    // usem_up() between the check and the wait is not lost.
+    __sync_fetch_and_add(&s->waiters, 1);
+    futex_wait(&s->value, 0);
+    __sync_fetch_and_sub(&s->waiters, 1);
+  }
+}
@@ -1,4 +1,5 @@
 struct stat;
+struct sem_op;
 
 /* Definiciones parciales abiertas a mejoras */
 // system calls
@@ -44,6 +45,14 @@ int sleep(int); // sleep(): Suspende la ejecución del proceso actual durante un
 
 int uptime(void); // uptime(): Obtiene el tiempo de actividad del sistema.
 
+int setaffinity(int mask); // setaffinity(): Restringe el proceso actual a las CPUs del bit mask (hijos lo heredan).
+
+int setquantum(int pid, int cycles); // setquantum(): Fija el quantum (en ciclos) del proceso pid, o el global si pid es 0. Devuelve el anterior.
+
+int setrt(int period, int budget); // setrt(): Pasa el proceso a tiempo real: budget ciclos cada period ciclos (0 para salir).
+
+int setgang(int gang); // setgang(): Agrupa al proceso (y sus hijos) con los del mismo gang, para correrlos en la misma CPU.
+
 // ulib.c
 
 int stat(const char *, struct stat *); // stat(): Obtiene información sobre un archivo o dispositivo de E/S.
@@ -78,8 +87,42 @@ void *memcpy(void *, const void *, uint); // memcpy(): Copia un bloque de memori
 
 int sem_open(int id_sem, int value); // sem_open(): Abre un semáforo
 
+int sem_create(int value); // sem_create(): Abre un semáforo con un id libre y lo devuelve
+
 int sem_close(int id_sem); // sem_close(): Cierra un semáforo
 
 int sem_up(int id_sem); // sem_up(): Incrementa el valor del semáforo
 
-int sem_down(int id_sem); // sem_down(): Decrementa el valor del semáforo
\ No newline at end of file
+int sem_down(int id_sem); // sem_down(): Decrementa el valor del semáforo
+
+int sem_trydown(int id_sem); // sem_trydown(): Decrementa el semáforo si no tiene que esperar (1 si no pudo)
+
+int sem_timeddown(int id_sem, int deadline); // sem_timeddown(): Decrementa el semáforo esperando hasta el tick deadline (1 si venció)
+
+int sem_op(struct sem_op *ops, int nops); // sem_op(): Aplica varios sem_up/sem_down en una sola llamada
+
+int mutex_create(void); // mutex_create(): Crea un mutex libre y devuelve su id (se cierra con sem_close)
+
+int mutex_lock(int id_sem); // mutex_lock(): Toma el mutex (2 si ya era del proceso)
+
+int mutex_unlock(int id_sem); // mutex_unlock(): Suelta el mutex (solo el proceso que lo tomó)
+
+int futex_wait(int *addr, int val); // futex_wait(): Duerme mientras *addr valga val
+
+int futex_wake(int *addr, int n); // futex_wake(): Despierta hasta n procesos esperando en addr
+
+void *mapshared(int npages); // mapshared(): Reserva páginas que se comparten (no se copian) con los hijos
+
+// Semáforo de usuario: vive en memoria compartida (ver mapshared) y solo
+// entra al kernel cuando tiene que dormir o despertar a alguien.
+struct usem
+{
+  int value;   // Valor del semáforo.
+  int waiters; // Procesos durmiendo (o por dormir) en futex_wait.
+};
+
+void usem_init(struct usem *, int value); // usem_init(): Inicializa un semáforo de usuario
+
+void usem_up(struct usem *); // usem_up(): Incrementa el semáforo de usuario
+
+void usem_down(struct usem *); // usem_down(): Decrementa el semáforo de usuario
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/trace.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2444,6 +2445,36 @@ textwrite(char *s)
     exit(xstatus);
 }
 
+// fork shares text pages: a read() into a child's text
+// must fail rather than overwrite the parent's code.
+void
+textcopyout(char *s)
+{
+  char before[16];
+  int fd, pid, xstatus;
+
+  memmove(before, (char*)textcopyout, sizeof(before));
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((fd = open("README", 0)) < 0)
+      exit(1);
+    exit(read(fd, (char*)textcopyout, sizeof(before)) == -1 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: read into text succeeded\n", s);
+    exit(1);
+  }
+  if(memcmp(before, (char*)textcopyout, sizeof(before)) != 0){
+    printf("%s: child's read changed parent's code\n", s);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2571,6 +2602,468 @@ badarg(char *s)
   exit(0);
 }
 
+// parent and child alternate through two user-space
+// semaphores in a page shared by mapshared().
+void
+sharedsem(char *s)
+{
+  struct usem *sem;
+  int *turn, pid, xstatus;
+  int n = 100;
+
+  sem = mapshared(1);
+  if(sem == (struct usem*)-1){
+    printf("%s: mapshared failed\n", s);
+    exit(1);
+  }
+  turn = (int*)&sem[2];
+  usem_init(&sem[0], 1);
+  usem_init(&sem[1], 0);
+  *turn = 0;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++){
+    usem_down(&sem[pid == 0 ? 1 : 0]);
+    if(*turn != 2*i + (pid == 0)){
+      printf("%s: out of order, turn %d\n", s, *turn);
+      exit(1);
+    }
+    *turn += 1;
+    usem_up(&sem[pid == 0 ? 0 : 1]);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0 || *turn != 2*n)
+    exit(1);
+}
+
+// sem_trydown() and sem_timeddown() give up instead of blocking.
+void
+semtimeout(char *s)
+{
+  int id, t0;
+
+  if((id = sem_create(0)) < 0){
+    printf("%s: sem_create failed\n", s);
+    exit(1);
+  }
+  if(sem_trydown(id) != 1){
+    printf("%s: sem_trydown on 0 did not fail\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if(sem_timeddown(id, t0 + 3) != 1 || uptime() < t0 + 3){
+    printf("%s: sem_timeddown did not time out\n", s);
+    exit(1);
+  }
+  sem_up(id);
+  if(sem_timeddown(id, uptime() + 100) != 0 || sem_trydown(id) != 1){
+    printf("%s: sem_timeddown did not take the unit\n", s);
+    exit(1);
+  }
+  sem_close(id);
+}
+
+// a mutex can only be released by its owner, and a second
+// mutex_lock() by the owner is reported instead of deadlocking.
+void
+mutexowner(char *s)
+{
+  int id, pid, xstatus;
+
+  if((id = mutex_create()) < 0){
+    printf("%s: mutex_create failed\n", s);
+    exit(1);
+  }
+  if(mutex_lock(id) != 0 || mutex_lock(id) != 2){
+    printf("%s: recursive mutex_lock not detected\n", s);
+    exit(1);
+  }
+  if(sem_up(id) != -1 || sem_down(id) != -1){
+    printf("%s: semaphore ops accepted a mutex\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(mutex_unlock(id) != -1)
+      exit(1);
+    // blocks until the parent lets go.
+    if(mutex_lock(id) != 0 || mutex_unlock(id) != 0)
+      exit(1);
+    exit(0);
+  }
+  sleep(2);
+  if(mutex_unlock(id) != 0 || mutex_unlock(id) != -1){
+    printf("%s: mutex_unlock by owner failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child could not use the mutex\n", s);
+    exit(1);
+  }
+
+  // a mutex held by a process that exits is released.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(mutex_lock(id) != 0);
+  wait(&xstatus);
+  if(xstatus != 0 || mutex_lock(id) != 0){
+    printf("%s: mutex not released on exit\n", s);
+    exit(1);
+  }
+  sem_close(id);
+}
+
+// scheduler events logged since the last call, read from
+// /dev/schedtrace (see schedlat). returns how many are in
+// schedev[], or -1 if the trace cannot be read.
+#define NSCHEDEV 2048
+
+struct schedevent schedev[NSCHEDEV];
+
+int
+readsched(void)
+{
+  int fd, n, r;
+
+  if((fd = open("/dev/schedtrace", O_RDONLY)) < 0)
+    return -1;
+  n = 0;
+  while(n < NSCHEDEV &&
+        (r = read(fd, &schedev[n], (NSCHEDEV - n) * sizeof(schedev[0]))) > 0)
+    n += r / sizeof(schedev[0]);
+  close(fd);
+  return n;
+}
+
+// the children of a process pinned to cpu 0 only run
+// there, as seen in the scheduler trace; a mask with
+// no usable cpu is refused.
+void
+affinity(char *s)
+{
+  int pids[4], xstatus, n, seen = 0;
+
+  if(setaffinity(0) != -1){
+    printf("%s: empty affinity mask accepted\n", s);
+    exit(1);
+  }
+  if(setaffinity(1) != 0){
+    printf("%s: setaffinity(1) failed\n", s);
+    exit(1);
+  }
+  if(readsched() < 0){
+    printf("%s: cannot read /dev/schedtrace\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 4; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      for(volatile int j = 0; j < 1000000; j++)
+        ;
+      exit(0);
+    }
+  }
+  for(int i = 0; i < 4; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  n = readsched();
+  for(int e = 0; e < n; e++){
+    if(schedev[e].type != SCHED_DISPATCH && schedev[e].type != SCHED_RUN)
+      continue;
+    for(int i = 0; i < 4; i++){
+      if(schedev[e].pid != pids[i])
+        continue;
+      if(schedev[e].cpu != 0){
+        printf("%s: pid %d ran on cpu %d\n", s, pids[i], schedev[e].cpu);
+        exit(1);
+      }
+      seen++;
+    }
+  }
+  if(seen == 0){
+    printf("%s: children not in the scheduler trace\n", s);
+    exit(1);
+  }
+  setaffinity(-1);
+}
+
+// a process with a short quantum gives up the cpu each
+// time it is spent, as seen in the scheduler trace, even
+// with a long global quantum; out of range quanta are
+// refused.
+void
+quantum(char *s)
+{
+  int pid, xstatus, old, n, yields = 0;
+
+  if(setquantum(0, 1) != -1 || setquantum(0, 0) != -1){
+    printf("%s: out of range quantum accepted\n", s);
+    exit(1);
+  }
+  if((old = setquantum(0, 2000000)) <= 0){
+    printf("%s: setquantum failed\n", s);
+    exit(1);
+  }
+  // the global quantum stays long only for this test.
+  if(readsched() < 0){
+    setquantum(0, old);
+    printf("%s: cannot read /dev/schedtrace\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    setquantum(0, old);
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // 20000 cycles is 1/50th of a tick: dozens of
+    // quanta in the 3 whole ticks it spins.
+    if(setquantum(getpid(), 20000) != 0)
+      exit(1);
+    for(int start = uptime(); uptime() == start; )
+      ;
+    for(int end = uptime() + 3; uptime() < end; )
+      ;
+    exit(0);
+  }
+  wait(&xstatus);
+  n = readsched();
+  setquantum(0, old);
+  if(xstatus != 0){
+    printf("%s: setquantum failed\n", s);
+    exit(1);
+  }
+  for(int e = 0; e < n; e++)
+    if(schedev[e].pid == pid && schedev[e].type == SCHED_YIELD)
+      yields++;
+  if(yields < 10){
+    printf("%s: only %d quanta in 3 ticks\n", s, yields);
+    exit(1);
+  }
+}
+
+// a real-time process with 60% of each tick reserved gets
+// most of a cpu it shares with a normal process of the
+// same quantum, which round robin would split evenly;
+// setrt() refuses impossible reservations.
+void
+realtime(char *s)
+{
+  int fds[2], pid, xstatus, end, msg[2], count[2];
+
+  if(setrt(100000, 200000) != -1 || setrt(1000000, 950000) != -1){
+    printf("%s: impossible reservation admitted\n", s);
+    exit(1);
+  }
+  if(setrt(1000000, 100000) != 0 || setrt(0, 0) != 0){
+    printf("%s: setrt failed\n", s);
+    exit(1);
+  }
+
+  // both on cpu 0, giving up the cpu as often as they can.
+  if(setaffinity(1) != 0 || setquantum(getpid(), TICKCYCLES / 100) != 0 ||
+     pipe(fds) != 0){
+    printf("%s: setup failed\n", s);
+    exit(1);
+  }
+  end = uptime() + 6;
+  for(int i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(i == 0 && setrt(TICKCYCLES, TICKCYCLES * 6 / 10) != 0)
+        exit(1);
+      msg[0] = i;
+      for(msg[1] = 0; uptime() < end; msg[1]++)
+        ;
+      write(fds[1], msg, sizeof(msg));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(int i = 0; i < 2; i++){
+    if(read(fds[0], msg, sizeof(msg)) != sizeof(msg)){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+    count[msg[0]] = msg[1];
+  }
+  for(int i = 0; i < 2; i++)
+    wait(&xstatus);
+  close(fds[0]);
+  if(count[0] < 2 * count[1]){
+    printf("%s: real-time %d vs normal %d\n", s, count[0], count[1]);
+    exit(1);
+  }
+}
+
+// FP registers are private to each process and survive
+// context switches; fork copies them.
+void
+fpu(char *s)
+{
+  volatile double x = 0.5;
+  int n = 4, xstatus;
+
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      double sum = 0;
+      x += i;
+      for(int j = 0; j < 1000000; j++)
+        sum += x;
+      exit(sum == x * 1000000 ? 0 : 1);
+    }
+  }
+  for(int i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: FP registers corrupted\n", s);
+      exit(1);
+    }
+  }
+  if(x != 0.5){
+    printf("%s: parent's FP value changed\n", s);
+    exit(1);
+  }
+}
+
+int countfree();
+
+// fork shares memory copy-on-write: it succeeds even when
+// a full copy would not fit, and writes stay private.
+void
+cowfork(char *s)
+{
+  int n = countfree() * 2 / 3, xstatus;
+  char *a = sbrk(n * PGSIZE);
+
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++)
+    a[i * PGSIZE] = i;
+
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < n; i += 100){
+      if(a[i * PGSIZE] != (char)i)
+        exit(1);
+      a[i * PGSIZE] = ~i;
+    }
+    // the kernel writing to a shared page must copy it too.
+    if(read(open("README", 0), a + PGSIZE + 1, 1) != 1 || a[PGSIZE] != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++){
+    if(a[i * PGSIZE] != (char)i || a[PGSIZE + 1] != 0){
+      printf("%s: child's write leaked into parent\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-n * PGSIZE);
+}
+
+// sbrk() only reserves address space: it can reserve more
+// than free memory, and pages appear zeroed when touched
+// by the process or by the kernel.
+void
+lazysbrk(char *s)
+{
+  uint64 n = (uint64)countfree() * 2 * PGSIZE;
+  char *a = sbrk(n);
+  char c;
+  int fd;
+
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk of twice the free memory failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  a[n - 1] = 1;
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, &c, 1) != 1){
+    printf("%s: read of README failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("README", 0);
+  if(read(fd, a + n / 2, 1) != 1 || a[n / 2] != c || a[n / 2 + 1] != 0){
+    printf("%s: kernel write to an untouched page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  sbrk(-n);
+}
+
+// program pages are read from the file on first touch,
+// even when read() of that same file is what touches them,
+// and so the file cannot be written while it runs.
+char execpagebuf[2*PGSIZE];
+
+void
+execpage(char *s)
+{
+  int fd;
+
+  if((fd = open("usertests", O_WRONLY)) >= 0 ||
+     (fd = open("usertests", O_RDONLY|O_TRUNC)) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+  fd = open("usertests", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  if(read(fd, execpagebuf, sizeof(execpagebuf)) != sizeof(execpagebuf) ||
+     execpagebuf[1] != 'E' || execpagebuf[2] != 'L' || execpagebuf[3] != 'F'){
+    printf("%s: read of own program failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2596,6 +3089,16 @@ struct test {
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
+  {sharedsem, "sharedsem"},
+  {semtimeout, "semtimeout"},
+  {mutexowner, "mutexowner"},
+  {affinity, "affinity"},
+  {quantum, "quantum"},
+  {realtime, "realtime"},
+  {fpu, "fpu"},
+  {cowfork, "cowfork"},
+  {lazysbrk, "lazysbrk"},
+  {execpage, "execpage"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
   {twochildren, "twochildren"},
@@ -2630,6 +3133,7 @@ struct test {
   {argptest, "argptest"},
   {stacktest, "stacktest"},
   {textwrite, "textwrite"},
+  {textcopyout, "textcopyout"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
@@ -40,3 +40,17 @@ entry("sem_open");
 entry("sem_close"); 
 entry("sem_up"); 
 entry("sem_down"); 
+entry("futex_wait");
+entry("futex_wake");
+entry("mapshared");
+entry("sem_create");
+entry("sem_op");
+entry("sem_trydown");
+entry("sem_timeddown");
+entry("mutex_create");
+entry("mutex_lock");
+entry("mutex_unlock");
+entry("setaffinity");
+entry("setquantum");
+entry("setrt");
+entry("setgang");